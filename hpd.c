@@ -16,331 +16,3000 @@
 #include <linux/kernel.h>
 #include <linux/workqueue.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/crc32.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/module.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
+#include <linux/pm_runtime.h>
+#include <linux/rcupdate.h>
+#include <linux/kref.h>
+#include <linux/seqlock.h>
+#include <linux/cpumask.h>
+#include <linux/topology.h>
+#include <linux/irq.h>
+#include <linux/static_call.h>
+#include <linux/jump_label.h>
 #include "hpd.h"
 
+#define CREATE_TRACE_POINTS
+#include "hpd_trace.h"
+
 #define MAX_EDID_READ_ATTEMPTS 5
 
-#define HPD_STABILIZE_MS 40
-#define HPD_DROP_TIMEOUT_MS 1500
-#define CHECK_PLUG_STATE_DELAY_MS 10
-#define CHECK_EDID_DELAY_MS 60
+#define HPD_STABILIZE_MS 40
+#define HPD_DROP_TIMEOUT_MS 1500
+#define CHECK_PLUG_STATE_DELAY_MS 10
+#define CHECK_EDID_DELAY_MS 60
+#define MAX_EDID_RETRY_DELAY_MS 1000
+#define NOTIFY_BATCH_MS 20
+#define HPD_STAGE_TIMEOUT_MS 500
+#define HPD_DROP_MARGIN_MS 50
+#define HPD_DROP_MIN_SAMPLES 4
+
+static const char * const state_names[] = {
+	"Reset",
+	"Check Plug",
+	"Check EDID",
+	"Disabled",
+	"Enabled",
+	"Wait for HPD reassert",
+	"Recheck EDID",
+	"Takeover from bootloader",
+	"Link training",
+	"Modeset",
+};
+
+/*
+ * hpd_data.edid_async, edid_prefetch and stage, protected by hpd_data.lock.
+ * Client stages use the same states as edid reads.
+ */
+enum {
+	EDID_ASYNC_IDLE = 0,
+	EDID_ASYNC_BUSY,
+	EDID_ASYNC_OK,
+	EDID_ASYNC_FAILED,
+	EDID_ASYNC_DISCARD,	/* read in flight, result unwanted */
+	EDID_ASYNC_WAIT,	/* as DISCARD, worker waits for completion */
+};
+
+/* The client's read still owns the ddc bus */
+static bool edid_in_flight(int async)
+{
+	return EDID_ASYNC_BUSY == async || EDID_ASYNC_DISCARD == async ||
+		EDID_ASYNC_WAIT == async;
+}
+
+static atomic_t hpd_instance_count = ATOMIC_INIT(0);
+
+static unsigned int notify_batch_ms = NOTIFY_BATCH_MS;
+module_param(notify_batch_ms, uint, 0644);
+MODULE_PARM_DESC(notify_batch_ms,
+	"Window to batch hotplug changes over for /dev/hpd readers");
+
+/* Instances listed on /dev/hpd */
+static LIST_HEAD(hpd_instances);
+static DEFINE_MUTEX(hpd_instances_lock);
+
+static atomic_t hpd_notify_seq = ATOMIC_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(hpd_notify_wait);
+
+static void hpd_notify_batch(struct work_struct *work)
+{
+	atomic_inc(&hpd_notify_seq);
+	wake_up_interruptible_all(&hpd_notify_wait);
+}
+static DECLARE_DELAYED_WORK(hpd_notify_work, hpd_notify_batch);
+
+/* Ddc buses declared through hpd_ops.ddc_bus */
+static LIST_HEAD(hpd_buses);
+static DEFINE_MUTEX(hpd_buses_lock);
+
+struct hpd_quirk_entry {
+	struct list_head node;
+	struct hpd_quirk quirk;
+};
+
+static LIST_HEAD(hpd_quirks);
+static DEFINE_MUTEX(hpd_quirks_lock);
+
+/*
+ * Ops table bound by hpd_bind_ops(). Instances using it call the hot
+ * ops directly through static calls, others through data->ops.
+ */
+static struct hpd_ops *hpd_bound_ops;
+static DEFINE_MUTEX(hpd_bind_lock);
+static DEFINE_STATIC_KEY_FALSE(hpd_ops_bound);
+
+DEFINE_STATIC_CALL_NULL(hpd_get_hpd_state, *hpd_bound_ops->get_hpd_state);
+DEFINE_STATIC_CALL_NULL(hpd_disable, *hpd_bound_ops->disable);
+DEFINE_STATIC_CALL_NULL(hpd_edid_read, *hpd_bound_ops->edid_read);
+DEFINE_STATIC_CALL_NULL(hpd_edid_read_start,
+	*hpd_bound_ops->edid_read_start);
+DEFINE_STATIC_CALL_NULL(hpd_edid_read_base, *hpd_bound_ops->edid_read_base);
+DEFINE_STATIC_CALL_NULL(hpd_edid_ready, *hpd_bound_ops->edid_ready);
+DEFINE_STATIC_CALL_NULL(hpd_edid_recheck, *hpd_bound_ops->edid_recheck);
+DEFINE_STATIC_CALL_NULL(hpd_sink_id, *hpd_bound_ops->sink_id);
+
+/* Call hot op @op of @data, NULL optional ops are checked by the caller */
+#define hpd_call(data, op, ...)						\
+	(static_branch_unlikely(&hpd_ops_bound) &&			\
+	 (data)->ops == hpd_bound_ops ?					\
+		static_call(hpd_##op)(__VA_ARGS__) :			\
+		(data)->ops->op(__VA_ARGS__))
+
+static bool set_hpd_state(struct hpd_data *data,
+			int target_state, int resched_time);
+static void resched_hpd_work(struct hpd_data *data, int resched_time);
+static bool hpd_bus_acquire(struct hpd_data *data, bool wait);
+static void hpd_bus_release(struct hpd_data *data);
+static void hpd_unbind_unused_ops(struct hpd_data *data);
+
+static void hpd_lock(struct hpd_data *data)
+{
+	if (mutex_trylock(&data->lock))
+		return;
+
+	mutex_lock(&data->lock);
+	data->stats.lock_contended++;
+}
+
+static void hpd_unlock(struct hpd_data *data)
+{
+	mutex_unlock(&data->lock);
+}
+
+/*
+ * An hpd event came in since the worker started. Whatever the worker
+ * found out is stale then, and the event is handled by the next run.
+ */
+static bool hpd_evt_stale(struct hpd_data *data)
+{
+	if (atomic_read(&data->evt_gen) == data->work_gen)
+		return false;
+
+	data->stats.stale_dropped++;
+
+	return true;
+}
+
+/* Publish state and edid for hpd_get_state(), hpd_data.lock held */
+static void hpd_status_publish(struct hpd_data *data)
+{
+	struct hpd_edid *edid = rcu_dereference_protected(data->edid,
+					lockdep_is_held(&data->lock));
+	struct hpd_status status = {
+		.state = data->state,
+		.gen = data->status[0].gen + 1,
+		.edid_key = edid ? edid->key : 0,
+	};
+
+	/* Retries and re-armed states change nothing a reader can see */
+	if (status.state == data->status[0].state &&
+		status.edid_key == data->status[0].edid_key)
+		return;
+
+	raw_write_seqcount_latch(&data->status_seq);
+	data->status[0] = status;
+	raw_write_seqcount_latch(&data->status_seq);
+	data->status[1] = status;
+}
+
+static void hpd_lat_add(struct hpd_latency *lat, u64 ns)
+{
+	u64 ms = div_u64(ns, NSEC_PER_MSEC);
+	int bucket = ms ? fls64(ms) : 0;
+
+	if (!lat->count || ns < lat->min_ns)
+		lat->min_ns = ns;
+	if (ns > lat->max_ns)
+		lat->max_ns = ns;
+	lat->total_ns += ns;
+	lat->count++;
+	lat->hist[min(bucket, HPD_LAT_BUCKETS - 1)]++;
+}
+
+/* Account time from the first unsettled hpd event till now */
+static void hpd_stats_evt_latency(struct hpd_data *data,
+				struct hpd_latency *lat)
+{
+	u64 evt_ns = atomic64_read(&data->stats.evt_ns);
+
+	hpd_lock(data);
+	if (evt_ns)
+		hpd_lat_add(lat, ktime_get_ns() - evt_ns);
+	hpd_unlock(data);
+}
+
+/* Called with data->lock held */
+static void hpd_stats_switch(struct hpd_data *data, int target_state)
+{
+	struct hpd_stats *stats = &data->stats;
+	u64 now = ktime_get_ns();
+
+	stats->state_time_ns[data->state] +=
+		now - stats->state_enter_ns[data->state];
+	stats->state_enter_ns[target_state] = now;
+	stats->state_entries[target_state]++;
+
+	if (STATE_DONE_ENABLED == target_state ||
+		STATE_DONE_DISABLED == target_state)
+		atomic64_set(&stats->evt_ns, 0);
+}
+
+/*
+ * Current hpd level. Use level reported with hpd_report_evt() if any,
+ * else poll the client.
+ */
+static bool hpd_get_level(struct hpd_data *data)
+{
+	int level = atomic_read(&data->hpd_level);
+
+	if (level < 0)
+		return hpd_call(data, get_hpd_state, data->drv_data);
+
+	return level;
+}
+
+/*
+ * Remaining part of a @ms debounce period, measured from the last hpd
+ * edge reported with hpd_report_evt() rather than from now.
+ */
+static int hpd_edge_delay(struct hpd_data *data, int ms)
+{
+	s64 elapsed;
+
+	if (atomic_read(&data->hpd_level) < 0)
+		return ms;
+
+	elapsed = ktime_get_ns() - atomic64_read(&data->hpd_edge_ns);
+	elapsed = div_s64(max_t(s64, elapsed, 0), NSEC_PER_MSEC);
+
+	return elapsed >= ms ? 0 : ms - elapsed;
+}
+
+/* Lockless, single slot writers may race only after ring wraps around */
+static void hpd_evt_record(struct hpd_data *data, int level, u64 ts_ns)
+{
+	u32 seq = atomic_inc_return(&data->evt_head);
+	struct hpd_edge *edge =
+		&data->evt_ring[(seq - 1) & (HPD_EVT_RING_SIZE - 1)];
+
+	WRITE_ONCE(edge->seq, 0);
+	smp_wmb();
+	edge->level = level;
+	edge->state = READ_ONCE(data->state);
+	edge->ts_ns = ts_ns;
+	smp_wmb();
+	WRITE_ONCE(edge->seq, seq);
+}
+
+/* Copy out edge @seq. Returns false if it was overwritten. */
+static bool hpd_evt_get(struct hpd_data *data, u32 seq,
+			struct hpd_edge *out)
+{
+	struct hpd_edge *edge =
+		&data->evt_ring[(seq - 1) & (HPD_EVT_RING_SIZE - 1)];
+
+	if (READ_ONCE(edge->seq) != seq)
+		return false;
+	smp_rmb();
+	*out = *edge;
+	smp_rmb();
+
+	return READ_ONCE(edge->seq) == seq;
+}
+
+/* Instance timing with the quirk of the known sink applied */
+static u32 hpd_stabilize_ms(struct hpd_data *data)
+{
+	u32 ms = READ_ONCE(data->quirk.stabilize_ms);
+
+	return ms ? ms : READ_ONCE(data->timing.stabilize_ms);
+}
+
+static u32 hpd_drop_timeout_ms(struct hpd_data *data)
+{
+	u32 ms = READ_ONCE(data->quirk.drop_timeout_ms);
+
+	return ms ? ms : READ_ONCE(data->timing.drop_timeout_ms);
+}
+
+static const struct hpd_retry_policy *hpd_edid_retry(struct hpd_data *data)
+{
+	if (READ_ONCE(data->quirk.edid_retry.max_attempts))
+		return &data->quirk.edid_retry;
+
+	return &data->timing.edid_retry;
+}
+
+/*
+ * Remaining time until hpd has been steady for stabilize_ms, judged by
+ * the last recorded event. 0 if there was none.
+ */
+static int hpd_steady_delay(struct hpd_data *data)
+{
+	u32 head = atomic_read(&data->evt_head);
+	u32 ms = hpd_stabilize_ms(data);
+	struct hpd_edge edge;
+	s64 elapsed;
+
+	if (!head)
+		return 0;
+	if (!hpd_evt_get(data, head, &edge))
+		return ms;
+
+	elapsed = div_s64(max_t(s64, ktime_get_ns() - edge.ts_ns, 0),
+			NSEC_PER_MSEC);
+
+	return elapsed >= ms ? 0 : ms - elapsed;
+}
+
+/*
+ * Check if all edges since the last handled event form pulses shorter
+ * than min_pulse_us, which left hpd at the level of the steady state.
+ */
+static bool hpd_evt_is_glitch(struct hpd_data *data, int cur_hpd, u32 head)
+{
+	u64 width_ns = (u64)READ_ONCE(data->timing.min_pulse_us) *
+			NSEC_PER_USEC;
+	u64 away_ns = 0;
+	struct hpd_edge edge;
+	int settled;
+	u32 seq;
+
+	if (!width_ns)
+		return false;
+
+	if (STATE_DONE_ENABLED == data->state)
+		settled = 1;
+	else if (STATE_DONE_DISABLED == data->state)
+		settled = 0;
+	else
+		return false;
+
+	if (cur_hpd != settled || head == data->evt_seen ||
+		head - data->evt_seen > HPD_EVT_RING_SIZE)
+		return false;
+
+	for (seq = data->evt_seen + 1; seq != head + 1; seq++) {
+		if (!hpd_evt_get(data, seq, &edge) || edge.level < 0)
+			return false;
+
+		if (edge.level != settled && !away_ns) {
+			away_ns = edge.ts_ns;
+		} else if (edge.level == settled && away_ns) {
+			if (edge.ts_ns - away_ns >= width_ns)
+				return false;
+			away_ns = 0;
+		}
+	}
+
+	return !away_ns;
+}
+
+static void hpd_disable(struct hpd_data *data)
+{
+	/* Spare the client a display teardown on every bounce */
+	if (!data->display_on) {
+		data->stats.disables_skipped++;
+		return;
+	}
+
+	/* Next run decides, maybe the display may stay up after all */
+	if (hpd_evt_stale(data))
+		return;
+
+	if (data->ops->disable) {
+		data->stats.disable_calls++;
+		hpd_call(data, disable, data->drv_data);
+		hpd_stats_evt_latency(data, &data->stats.evt_to_disable);
+	}
+	data->display_on = false;
+}
+
+static void hpd_edid_ready(struct hpd_data *data)
+{
+	/* Don't enable a sink that may be gone already */
+	if (hpd_evt_stale(data))
+		return;
+
+	if (data->ops->edid_ready) {
+		data->stats.edid_ready_calls++;
+		hpd_call(data, edid_ready, data->drv_data);
+		hpd_stats_evt_latency(data, &data->stats.evt_to_ready);
+	}
+	data->display_on = true;
+}
+
+static u32 edid_retry_delay(struct hpd_data *data, int step)
+{
+	const struct hpd_retry_policy *policy = hpd_edid_retry(data);
+	u64 delay = policy->initial_delay_ms;
+
+	while (step-- > 0 && delay < policy->max_delay_ms)
+		delay = div_u64(delay * policy->multiplier_pct, 100);
+
+	return min_t(u64, delay, policy->max_delay_ms);
+}
+
+static struct hpd_sink_hint *sink_hint_find(struct hpd_data *data, u32 id)
+{
+	int i;
+
+	for (i = 0; id && i < HPD_SINK_HINTS; i++)
+		if (data->sink_hints[i].sink_id == id)
+			return &data->sink_hints[i];
+
+	return NULL;
+}
+
+/* Key of the known edid, 0 if none */
+static u32 hpd_edid_key(struct hpd_data *data)
+{
+	struct hpd_edid *edid;
+	u32 key = 0;
+
+	rcu_read_lock();
+	edid = rcu_dereference(data->edid);
+	if (edid)
+		key = edid->key;
+	rcu_read_unlock();
+
+	return key;
+}
+
+static void sink_hint_add_drop(struct hpd_sink_hint *hint, u64 ms)
+{
+	hint->drop_ms[hint->drop_next] = min_t(u64, ms, U16_MAX);
+	hint->drop_next = (hint->drop_next + 1) % HPD_DROP_SAMPLES;
+	if (hint->drop_count < HPD_DROP_SAMPLES)
+		hint->drop_count++;
+}
+
+/* Remember the attempts the connected sink needed for a good edid read */
+static void sink_hint_update(struct hpd_data *data)
+{
+	struct hpd_sink_hint *hint;
+	u32 attempts;
+
+	if (data->ops->sink_id)
+		data->sink_id = hpd_call(data, sink_id, data->drv_data);
+	else if (rcu_access_pointer(data->edid))
+		data->sink_id = hpd_edid_key(data);
+	if (!data->sink_id)
+		return;
+
+	hint = sink_hint_find(data, data->sink_id);
+	if (!hint) {
+		hint = &data->sink_hints[data->sink_hint_next];
+		data->sink_hint_next = (data->sink_hint_next + 1) %
+					HPD_SINK_HINTS;
+		memset(hint, 0, sizeof(*hint));
+		hint->sink_id = data->sink_id;
+	}
+	/*
+	 * Attempts of this series, the ones edid_first_delay() skipped
+	 * included, i.e. skipped + failed reads + 1. A first read working
+	 * after skips may have worked sooner, so the hint comes down a step.
+	 */
+	attempts = data->edid_step;
+	if (!data->edid_reads && attempts > 1)
+		attempts--;
+	hint->attempts = attempts;
+
+	/* Same sink is back, the shortened drop wait was too short for it */
+	if (data->drop_len_ms && data->drop_sink == data->sink_id) {
+		pr_debug("hpd: %s: missed %u ms drop\n", data->name,
+			data->drop_len_ms);
+		sink_hint_add_drop(hint, data->drop_len_ms);
+		data->stats.drop_mispredictions++;
+	}
+	data->drop_len_ms = 0;
+}
+
+/*
+ * Time to wait in WAIT_FOR_HPD_REASSERT: the longest drop seen of the
+ * connected sink plus margin with HPD_FLAG_LEARN_DROP, else or until
+ * enough drops are known, the drop timeout.
+ */
+static u32 hpd_drop_wait_ms(struct hpd_data *data)
+{
+	u32 timeout = hpd_drop_timeout_ms(data);
+	struct hpd_sink_hint *hint;
+	u32 wait = 0;
+	int i;
+
+	data->drop_learned = false;
+	if (!(data->flags & HPD_FLAG_LEARN_DROP))
+		return timeout;
+
+	hint = sink_hint_find(data, data->sink_id);
+	if (!hint || hint->drop_count < HPD_DROP_MIN_SAMPLES)
+		return timeout;
+
+	for (i = 0; i < hint->drop_count; i++)
+		wait = max_t(u32, wait, hint->drop_ms[i]);
+	wait += READ_ONCE(data->timing.drop_margin_ms);
+	if (wait >= timeout)
+		return timeout;
+
+	data->drop_learned = true;
+	data->stats.drop_learned_waits++;
+
+	return wait;
+}
+
+/*
+ * Start a new series of edid read attempts and return the delay before
+ * the first one. If the last known sink needed several attempts, skip
+ * straight to the delay that worked for it.
+ */
+static int edid_first_delay(struct hpd_data *data)
+{
+	struct hpd_sink_hint *hint = sink_hint_find(data, data->sink_id);
+	int attempts = hint ? hint->attempts : 1;
+	u32 delay = 0;
+
+	data->edid_reads = 0;
+	for (data->edid_step = 0; data->edid_step < attempts;
+		data->edid_step++)
+		delay += edid_retry_delay(data, data->edid_step);
+
+	return delay;
+}
+
+static bool edid_attempts_done(struct hpd_data *data)
+{
+	return data->edid_reads >=
+		READ_ONCE(hpd_edid_retry(data)->max_attempts);
+}
+
+static int edid_next_delay(struct hpd_data *data)
+{
+	return edid_retry_delay(data, data->edid_step++);
+}
+
+static void hpd_retry_init(struct hpd_retry_policy *retry)
+{
+	if (!retry->initial_delay_ms)
+		retry->initial_delay_ms = CHECK_EDID_DELAY_MS;
+	if (!retry->multiplier_pct)
+		retry->multiplier_pct = 100;
+	if (!retry->max_delay_ms)
+		retry->max_delay_ms = max_t(u32, MAX_EDID_RETRY_DELAY_MS,
+					retry->initial_delay_ms);
+	if (!retry->max_attempts)
+		retry->max_attempts = MAX_EDID_READ_ATTEMPTS;
+}
+
+/* Called with hpd_quirks_lock held */
+static struct hpd_quirk_entry *hpd_quirk_find(u16 vendor, u16 product)
+{
+	struct hpd_quirk_entry *entry;
+
+	list_for_each_entry(entry, &hpd_quirks, node)
+		if (entry->quirk.vendor == vendor &&
+			entry->quirk.product == product)
+			return entry;
+
+	return NULL;
+}
+
+static void hpd_edid_release(struct kref *ref)
+{
+	struct hpd_edid *edid = container_of(ref, struct hpd_edid, ref);
+
+	kfree_rcu(edid, rcu);
+}
+
+void hpd_edid_put(struct hpd_edid *edid)
+{
+	if (edid)
+		kref_put(&edid->ref, hpd_edid_release);
+}
+
+/* Make @edid the known edid and pick up its quirk, hpd_data.lock held */
+static void hpd_edid_set(struct hpd_data *data, struct hpd_edid *edid)
+{
+	struct hpd_quirk_entry *entry = NULL;
+	struct hpd_edid *old;
+	u16 vendor, product;
+
+	old = rcu_dereference_protected(data->edid,
+					lockdep_is_held(&data->lock));
+	if (edid == old)
+		return;
+
+	/* hpd_data.edid holds a reference of its own */
+	if (edid)
+		kref_get(&edid->ref);
+	rcu_assign_pointer(data->edid, edid);
+	hpd_edid_put(old);
+	hpd_status_publish(data);
+
+	if (edid) {
+		vendor = edid->blob[8] << 8 | edid->blob[9];
+		product = edid->blob[10] | edid->blob[11] << 8;
+
+		mutex_lock(&hpd_quirks_lock);
+		entry = hpd_quirk_find(vendor, product);
+		if (entry)
+			data->quirk = entry->quirk;
+		mutex_unlock(&hpd_quirks_lock);
+	}
+
+	if (entry)
+		pr_debug("hpd: %s: quirk for sink %04x:%04x\n", data->name,
+			vendor, product);
+	else
+		memset(&data->quirk, 0, sizeof(data->quirk));
+}
+
+static u32 edid_key(const u8 *base)
+{
+	return crc32_le(~0, base, HPD_EDID_BLOCK_LEN);
+}
+
+/* Called with data->lock held */
+static struct hpd_edid *edid_cache_find(struct hpd_data *data,
+					const u8 *base, u32 key)
+{
+	struct hpd_edid *edid;
+
+	list_for_each_entry(edid, &data->edid_cache, node)
+		if (edid->key == key &&
+			!memcmp(edid->blob, base, HPD_EDID_BLOCK_LEN))
+			return edid;
+
+	return NULL;
+}
+
+/*
+ * Compare sink's edid base block against the edid cache. On a hit the
+ * cached edid becomes current. Returns 1 on hit, 0 on miss or no cache
+ * and -1 on base block read failure.
+ */
+static int edid_cache_lookup(struct hpd_data *data)
+{
+	u8 base[HPD_EDID_BLOCK_LEN];
+	struct hpd_edid *edid;
+	u32 key;
+
+	if (!data->ops->edid_read_base || list_empty(&data->edid_cache))
+		return 0;
+
+	data->stats.ddc_reads++;
+	if (!hpd_call(data, edid_read_base, data->drv_data, base))
+		return -1;
+
+	key = edid_key(base);
+
+	hpd_lock(data);
+	edid = edid_cache_find(data, base, key);
+	if (edid) {
+		list_move(&edid->node, &data->edid_cache);
+		hpd_edid_set(data, edid);
+		data->stats.edid_cache_hits++;
+	} else {
+		data->stats.edid_cache_misses++;
+	}
+	hpd_unlock(data);
+
+	return edid ? 1 : 0;
+}
+
+/*
+ * Check for edid change by the base block alone, which carries vendor,
+ * product, serial and extension count. Returns -1 on read failure, 1 on
+ * change and 0 on same edid.
+ */
+static int edid_recheck_base(struct hpd_data *data)
+{
+	u8 base[HPD_EDID_BLOCK_LEN];
+	struct hpd_edid *edid;
+	int changed = 1;
+	u32 key;
+
+	data->stats.ddc_reads++;
+	if (!hpd_call(data, edid_read_base, data->drv_data, base))
+		return -1;
+
+	key = edid_key(base);
+
+	hpd_lock(data);
+	edid = rcu_dereference_protected(data->edid,
+					lockdep_is_held(&data->lock));
+	if (edid && edid->key == key &&
+		!memcmp(edid->blob, base, HPD_EDID_BLOCK_LEN))
+		changed = 0;
+	hpd_unlock(data);
+
+	return changed;
+}
+
+static void hpd_reset_state(struct hpd_data *data)
+{
+	/*
+	 * Shut everything down, then schedule a
+	 * check of the plug state in the near future.
+	 */
+	hpd_disable(data);
+	set_hpd_state(data, STATE_PLUG,
+			READ_ONCE(data->timing.check_plug_delay_ms));
+}
+
+/*
+ * Speculative edid read while hpd is debounced, see HPD_FLAG_EDID_PREFETCH.
+ * Never waits for the ddc bus, the regular read does that.
+ */
+static void edid_prefetch_start(struct hpd_data *data)
+{
+	if (!(data->flags & HPD_FLAG_EDID_PREFETCH) ||
+		!data->ops->edid_read_start)
+		return;
+
+	hpd_lock(data);
+	if (EDID_ASYNC_BUSY == data->edid_prefetch ||
+		EDID_ASYNC_DISCARD == data->edid_prefetch ||
+		EDID_ASYNC_IDLE != data->edid_async ||
+		!hpd_bus_acquire(data, false)) {
+		hpd_unlock(data);
+		return;
+	}
+	data->edid_prefetch = EDID_ASYNC_BUSY;
+	hpd_unlock(data);
+
+	pr_debug("hpd: prefetching EDID\n");
+	data->stats.ddc_reads++;
+	if (hpd_call(data, edid_read_start, data->drv_data))
+		return;
+
+	hpd_lock(data);
+	if (EDID_ASYNC_BUSY == data->edid_prefetch ||
+		EDID_ASYNC_DISCARD == data->edid_prefetch) {
+		data->edid_prefetch = EDID_ASYNC_IDLE;
+		hpd_bus_release(data);
+	}
+	hpd_unlock(data);
+}
+
+/* Forget the prefetch result, a read in flight is dropped on completion */
+static void edid_prefetch_discard(struct hpd_data *data)
+{
+	hpd_lock(data);
+	switch (data->edid_prefetch) {
+	case EDID_ASYNC_BUSY:
+		data->edid_prefetch = EDID_ASYNC_DISCARD;
+		data->stats.edid_prefetch_discards++;
+		break;
+	case EDID_ASYNC_OK:
+	case EDID_ASYNC_FAILED:
+		data->edid_prefetch = EDID_ASYNC_IDLE;
+		data->stats.edid_prefetch_discards++;
+		break;
+	}
+	hpd_unlock(data);
+}
+
+/*
+ * Take over the prefetch on entering CHECK_EDID. Returns the prefetch
+ * state; if still in flight it carries on as the asynchronous edid read.
+ */
+static int edid_prefetch_take(struct hpd_data *data)
+{
+	int prefetch;
+
+	hpd_lock(data);
+	prefetch = data->edid_prefetch;
+	switch (prefetch) {
+	case EDID_ASYNC_BUSY:
+		data->edid_async = EDID_ASYNC_BUSY;
+		fallthrough;
+	case EDID_ASYNC_OK:
+		data->stats.edid_prefetch_hits++;
+		fallthrough;
+	case EDID_ASYNC_FAILED:
+		data->edid_prefetch = EDID_ASYNC_IDLE;
+		break;
+	}
+	hpd_unlock(data);
+
+	return prefetch;
+}
+
+/*
+ * Next client stage after @state the client implements, else DONE_ENABLED.
+ * Stages run in the order of their states.
+ */
+static int hpd_stage_next(struct hpd_data *data, int state)
+{
+	if (state < STATE_LINK_TRAIN && data->ops->link_train_start)
+		return STATE_LINK_TRAIN;
+	if (state < STATE_MODESET && data->ops->modeset_start)
+		return STATE_MODESET;
+
+	return STATE_DONE_ENABLED;
+}
+
+/* Abort client stage in flight, and forget a result not yet processed */
+static void hpd_stage_abort(struct hpd_data *data)
+{
+	bool busy;
+
+	hpd_lock(data);
+	busy = EDID_ASYNC_BUSY == data->stage;
+	data->stage = EDID_ASYNC_IDLE;
+	hpd_unlock(data);
+
+	if (busy && data->ops->stage_abort) {
+		pr_debug("hpd: aborting %s\n", state_names[data->state]);
+		data->ops->stage_abort(data->drv_data);
+	}
+}
+
+/* Drive the asynchronous client stage of the current state */
+static void hpd_stage_state(struct hpd_data *data,
+			bool (*start)(void *drv_data))
+{
+	int stage, tgt_state;
+
+	hpd_lock(data);
+	stage = data->stage;
+	if (EDID_ASYNC_IDLE == stage)
+		data->stage = EDID_ASYNC_BUSY;
+	else
+		data->stage = EDID_ASYNC_IDLE;
+	hpd_unlock(data);
+
+	switch (stage) {
+	case EDID_ASYNC_IDLE:
+		/*
+		 * Arm the timeout first, as for asynchronous edid reads. Not
+		 * started at all for a sink a newer event may have removed.
+		 */
+		if (!set_hpd_state(data, data->state,
+				READ_ONCE(data->timing.stage_timeout_ms))) {
+			hpd_lock(data);
+			data->stage = EDID_ASYNC_IDLE;
+			hpd_unlock(data);
+			return;
+		}
+		if (start(data->drv_data))
+			return;
+
+		hpd_lock(data);
+		data->stage = EDID_ASYNC_IDLE;
+		hpd_unlock(data);
+		break;
+	case EDID_ASYNC_BUSY:
+		pr_info("hpd: %s timed out\n", state_names[data->state]);
+		if (data->ops->stage_abort)
+			data->ops->stage_abort(data->drv_data);
+		break;
+	case EDID_ASYNC_OK:
+		tgt_state = hpd_stage_next(data, data->state);
+		set_hpd_state(data, tgt_state,
+				STATE_DONE_ENABLED == tgt_state ? -1 : 0);
+		return;
+	}
+
+	pr_info("hpd: %s failed, disabling display\n",
+		state_names[data->state]);
+	hpd_disable(data);
+	set_hpd_state(data, STATE_DONE_DISABLED, -1);
+}
+
+static void link_train_state(struct hpd_data *data)
+{
+	hpd_stage_state(data, data->ops->link_train_start);
+}
+
+static void modeset_state(struct hpd_data *data)
+{
+	hpd_stage_state(data, data->ops->modeset_start);
+}
+
+static void hpd_plug_state(struct hpd_data *data)
+{
+	if (hpd_get_level(data)) {
+		int delay = edid_first_delay(data);
+
+		/* A prefetch already talked to the sink, pick it up now */
+		switch (READ_ONCE(data->edid_prefetch)) {
+		case EDID_ASYNC_BUSY:
+		case EDID_ASYNC_OK:
+			delay = 0;
+			break;
+		}
+
+		/*
+		 * Looks like there is something plugged in.
+		 * Get ready to read the sink's EDID information.
+		 */
+		set_hpd_state(data, STATE_CHECK_EDID, delay);
+	} else {
+		/*
+		 * Nothing plugged in, so we are finished. Go to the
+		 * DONE_DISABLED state and stay there until the next HPD event.
+		 */
+		edid_prefetch_discard(data);
+		hpd_disable(data);
+		set_hpd_state(data, STATE_DONE_DISABLED, -1);
+	}
+}
+
+/*
+ * A discarded edid read is still on the ddc bus. Nothing else may talk
+ * to the sink until it completes, which wakes the worker up again.
+ * Returns true if so.
+ */
+static bool edid_async_draining(struct hpd_data *data)
+{
+	bool draining = false;
+
+	hpd_lock(data);
+	if (EDID_ASYNC_DISCARD == data->edid_async ||
+		EDID_ASYNC_WAIT == data->edid_async) {
+		data->edid_async = EDID_ASYNC_WAIT;
+		draining = true;
+	}
+	hpd_unlock(data);
+
+	return draining;
+}
+
+/*
+ * Drive an asynchronous edid read. Returns false while the read is in
+ * flight, else true with the outcome in @ok.
+ */
+static bool edid_read_async(struct hpd_data *data, bool *ok)
+{
+	int async;
+
+	if (edid_async_draining(data))
+		return false;
+
+	hpd_lock(data);
+	async = data->edid_async;
+	if (EDID_ASYNC_IDLE == async)
+		data->edid_async = EDID_ASYNC_BUSY;
+	else if (EDID_ASYNC_BUSY == async)
+		/* Timed out, the bus stays ours until the read completes */
+		data->edid_async = EDID_ASYNC_DISCARD;
+	else
+		data->edid_async = EDID_ASYNC_IDLE;
+	hpd_unlock(data);
+
+	switch (async) {
+	case EDID_ASYNC_IDLE:
+		/*
+		 * Arm the timeout before starting the read, so an early
+		 * completion is not pushed back by it. No read is started if
+		 * a newer event is due, the bus is left as is for it.
+		 */
+		if (!set_hpd_state(data, STATE_CHECK_EDID,
+				READ_ONCE(data->timing.edid_timeout_ms))) {
+			hpd_lock(data);
+			data->edid_async = EDID_ASYNC_IDLE;
+			hpd_unlock(data);
+			return false;
+		}
+		data->stats.ddc_reads++;
+		if (hpd_call(data, edid_read_start, data->drv_data))
+			return false;
+
+		hpd_lock(data);
+		data->edid_async = EDID_ASYNC_IDLE;
+		hpd_unlock(data);
+		*ok = false;
+		break;
+	case EDID_ASYNC_BUSY:
+		pr_debug("hpd: EDID read timed out\n");
+		*ok = false;
+		break;
+	default:
+		*ok = (EDID_ASYNC_OK == async);
+		break;
+	}
+
+	return true;
+}
+
+static void edid_check_state(struct hpd_data *data)
+{
+	bool status;
+	int cached, tgt_state;
+
+	if (!hpd_get_level(data)) {
+		/* hpd dropped - stop EDID read */
+		pr_debug("hpd: dropped, abort EDID read\n");
+		edid_prefetch_discard(data);
+		goto end_disabled;
+	}
+
+	switch (edid_prefetch_take(data)) {
+	case EDID_ASYNC_OK:
+		status = true;
+		goto read_done;
+	case EDID_ASYNC_BUSY:
+		/* Bus is ours already, wait for the prefetch to complete */
+		set_hpd_state(data, STATE_CHECK_EDID,
+				READ_ONCE(data->timing.edid_timeout_ms));
+		return;
+	}
+
+	/* Woken up again once the ddc bus is free */
+	if (!hpd_bus_acquire(data, true))
+		return;
+
+	if (edid_async_draining(data))
+		return;
+
+	/*
+	 * Look the sink up on the first attempt of a series only, a retry
+	 * would read the base block again just to miss. No base block read
+	 * while an asynchronous read is in flight.
+	 */
+	cached = 0;
+	if (!data->edid_reads &&
+		EDID_ASYNC_IDLE == READ_ONCE(data->edid_async))
+		cached = edid_cache_lookup(data);
+
+	if (cached) {
+		status = cached > 0;
+	} else if (data->ops->edid_read_start) {
+		if (!edid_read_async(data, &status))
+			return;
+	} else {
+		data->stats.ddc_reads++;
+		status = hpd_call(data, edid_read, data->drv_data);
+	}
+read_done:
+	trace_hpd_edid_read(data, data->edid_reads + 1, status);
+	if (!status) {
+		/*
+		 * Failed to read EDID. If we still have retry attempts left,
+		 * schedule another attempt. Otherwise give up and just go to
+		 * the disabled state.
+		 */
+		data->edid_reads++;
+		if (edid_attempts_done(data)) {
+			pr_info("hpd: EDID read failed %d times. Giving up.\n",
+				data->edid_reads);
+			data->stats.edid_failures++;
+			goto end_disabled;
+		} else {
+			data->stats.edid_retries++;
+			set_hpd_state(data, STATE_CHECK_EDID,
+					edid_next_delay(data));
+		}
+
+		return;
+	}
+
+	sink_hint_update(data);
+
+	hpd_edid_ready(data);
+
+	tgt_state = hpd_stage_next(data, STATE_CHECK_EDID);
+	set_hpd_state(data, tgt_state,
+			STATE_DONE_ENABLED == tgt_state ? -1 : 0);
+
+	return;
+end_disabled:
+	hpd_disable(data);
+	set_hpd_state(data, STATE_DONE_DISABLED, -1);
+}
+
+static void wait_for_hpd_reassert_state(struct hpd_data *data)
+{
+	/*
+	 * Looks like HPD dropped and really did stay low.
+	 * Go ahead and reset the system.
+	 */
+	if (!data->drop_learned)
+		data->drop_ns = 0;
+	set_hpd_state(data, STATE_HPD_RESET, 0);
+}
+
+/*
+ * Compare sink's edid against the one in use. Retries stay in
+ * @retry_state, an unchanged edid leads to DONE_ENABLED and anything
+ * else resets the state machine.
+ */
+static void edid_recheck(struct hpd_data *data, int retry_state)
+{
+	int tgt_state, timeout, status;
+
+	tgt_state = STATE_HPD_RESET;
+	timeout = 0;
+
+	/* Woken up again once the ddc bus is free */
+	if (!hpd_bus_acquire(data, true) || edid_async_draining(data))
+		return;
+
+	/*
+	 * With a known edid only its base block needs reading. Any change
+	 * there resets the state machine, which reads the full edid.
+	 */
+	if (data->ops->edid_read_base &&
+		(rcu_access_pointer(data->edid) || !data->ops->edid_recheck)) {
+		status = edid_recheck_base(data);
+	} else {
+		data->stats.ddc_reads++;
+		status = hpd_call(data, edid_recheck, data->drv_data);
+	}
+	trace_hpd_edid_read(data, data->edid_reads + 1, status);
+
+	if (status == -1) {
+		/*
+		 * Failed to read EDID. If we still have retry attempts left,
+		 * schedule another attempt. Otherwise give up and reset;
+		 */
+		data->edid_reads++;
+		if (edid_attempts_done(data)) {
+			pr_info("hpd: EDID retry %d times. Giving up.\n",
+				data->edid_reads);
+			data->stats.edid_failures++;
+		} else {
+			data->stats.edid_retries++;
+			tgt_state = retry_state;
+			timeout = edid_next_delay(data);
+		}
+	} else if (status == 0) {
+		/*
+		 * Successful read and EDID is unchanged, just go back to
+		 * the DONE_ENABLED state and do nothing.
+		 */
+		pr_debug("hpd: No EDID change, taking no action.\n");
+		sink_hint_update(data);
+		tgt_state = STATE_DONE_ENABLED;
+		timeout = -1;
+		/* Verified, later bounces in DONE_ENABLED are ignored again */
+		data->edid_verify = false;
+	}
+
+	if (tgt_state != retry_state)
+		data->edid_verify = false;
+
+	/* Changed or unreadable sink, read it again without its hint */
+	if (STATE_HPD_RESET == tgt_state)
+		data->sink_id = 0;
+
+	set_hpd_state(data, tgt_state, timeout);
+}
+
+static void edid_recheck_state(struct hpd_data *data)
+{
+	edid_recheck(data, STATE_RECHECK_EDID);
+}
+
+static void done_enabled_state(struct hpd_data *data)
+{
+	/*
+	 * Only ever scheduled to verify in background the edid taken over
+	 * from bootloader or kept over system suspend, while display stays
+	 * up.
+	 */
+	if (!data->edid_verify) {
+		pr_warn("hpd: unexpected wakeup in state %d\n", data->state);
+		return;
+	}
+
+	edid_recheck(data, STATE_DONE_ENABLED);
+}
+
+static void bootloader_takeover_state(struct hpd_data *data)
+{
+	int timeout;
+
+	if (!data->boot.enabled) {
+		pr_warn("hpd: unexpected wakeup in state %d\n", data->state);
+		return;
+	}
+
+	if (!hpd_get_level(data)) {
+		/*
+		 * Nothing plugged in. Let STATE_PLUG confirm it and disable
+		 * display, as on an hpd event in this state.
+		 */
+		set_hpd_state(data, STATE_PLUG, hpd_stabilize_ms(data));
+		return;
+	}
+
+	timeout = hpd_steady_delay(data);
+	if (timeout) {
+		/* Hpd still settling, look again later */
+		set_hpd_state(data, STATE_INIT_FROM_BOOTLOADER, timeout);
+		return;
+	}
+
+	/*
+	 * Hpd is steady and bootloader left the display running. Keep it
+	 * that way, skip the edid read and confirm the edid in background.
+	 */
+	pr_debug("hpd: taking over display from bootloader\n");
+	hpd_edid_ready(data);
+
+	data->edid_verify = true;
+	set_hpd_state(data, STATE_DONE_ENABLED, edid_first_delay(data));
+}
+
+/*
+ * Hpd event handling is table driven. Each state has a handler run when
+ * its timer expires, and a transition for hpd found low or high on an hpd
+ * event. Transition delays are one of HPD_DELAY_*, resolved against the
+ * instance timing when the event is handled.
+ */
+enum {
+	HPD_EVT_LOW = 0,
+	HPD_EVT_HIGH,
+	HPD_EVT_COUNT,
+};
+
+enum {
+	HPD_DELAY_NONE = 0,
+	HPD_DELAY_STABILIZE,	/* stabilize_ms after the edge */
+	HPD_DELAY_DROP,		/* drop_timeout_ms after the edge */
+	HPD_DELAY_EDID,		/* first edid read attempt */
+	HPD_DELAY_STEADY,	/* until hpd has been steady long enough */
+	HPD_DELAY_COUNT,
+};
+
+static const char * const delay_names[] = {
+	"",
+	" +stabilize",
+	" +drop timeout",
+	" +edid delay",
+	" +steady",
+};
+
+/* hpd_transition.target to ignore the event and stay in current state */
+#define STATE_KEEP -1
+
+struct hpd_transition {
+	int target;
+	int delay;
+	/* called before switching, may amend the transition */
+	void (*action)(struct hpd_data *data, int cur_hpd,
+			struct hpd_transition *t);
+};
+
+struct hpd_state_desc {
+	/* timer expired with no hpd event pending, NULL if never armed */
+	void (*run)(struct hpd_data *data);
+	/* states run may switch to, only used to draw the state graph */
+	unsigned int exits;
+	struct hpd_transition on[HPD_EVT_COUNT];
+};
+
+/* Time of the edge that raised the event being handled */
+static u64 hpd_evt_ts(struct hpd_data *data)
+{
+	struct hpd_edge edge;
+
+	if (hpd_evt_get(data, data->evt_seen, &edge))
+		return edge.ts_ns;
+
+	return ktime_get_ns();
+}
+
+static void hpd_evt_prefetch(struct hpd_data *data, int cur_hpd,
+			struct hpd_transition *t)
+{
+	/* Sink given up after a shortened drop wait may be back already */
+	if (cur_hpd && data->drop_ns && data->drop_learned) {
+		u64 ms = div_u64(hpd_evt_ts(data) - data->drop_ns,
+				NSEC_PER_MSEC);
+
+		if (ms < hpd_drop_timeout_ms(data))
+			data->drop_len_ms = ms;
+		data->drop_ns = 0;
+	}
+
+	edid_prefetch_discard(data);
+	if (cur_hpd)
+		edid_prefetch_start(data);
+}
+
+static void hpd_evt_drop(struct hpd_data *data, int cur_hpd,
+			struct hpd_transition *t)
+{
+	data->drop_ns = hpd_evt_ts(data);
+	data->drop_sink = data->sink_id;
+	data->drop_len_ms = 0;
+}
+
+static void hpd_evt_reassert(struct hpd_data *data, int cur_hpd,
+			struct hpd_transition *t)
+{
+	struct hpd_sink_hint *hint = sink_hint_find(data, data->drop_sink);
+
+	if (hint && data->drop_ns)
+		sink_hint_add_drop(hint, div_u64(hpd_evt_ts(data) -
+					data->drop_ns, NSEC_PER_MSEC));
+	data->drop_ns = 0;
+}
+
+static void hpd_evt_bounce(struct hpd_data *data, int cur_hpd,
+			struct hpd_transition *t)
+{
+	pr_debug("hpd: ignoring bouncing hpd\n");
+	trace_hpd_bounce_ignored(data);
+}
+
+static void hpd_evt_stage_abort(struct hpd_data *data, int cur_hpd,
+			struct hpd_transition *t)
+{
+	hpd_stage_abort(data);
+	hpd_evt_prefetch(data, cur_hpd, t);
+}
+
+static void hpd_evt_bootloader(struct hpd_data *data, int cur_hpd,
+			struct hpd_transition *t)
+{
+	if (data->boot.enabled) {
+		/*
+		 * Bootloader left display running. Let the takeover check
+		 * again once hpd has been steady for a while.
+		 */
+		t->target = STATE_INIT_FROM_BOOTLOADER;
+		t->delay = HPD_DELAY_STEADY;
+		return;
+	}
+
+	hpd_evt_prefetch(data, cur_hpd, t);
+}
+
+/*
+ * Looks like there was HPD activity while we were neither waiting for it
+ * to go away during steady state output, nor looking for it to come back
+ * after such an event. Wait until HPD has been steady for at least 40 mSec,
+ * then restart the state machine.
+ */
+#define HPD_RESTART { STATE_HPD_RESET, HPD_DELAY_STABILIZE, hpd_evt_prefetch }
+
+/* Same, but abort the client stage in flight first */
+#define HPD_RESTART_STAGE \
+	{ STATE_HPD_RESET, HPD_DELAY_STABILIZE, hpd_evt_stage_abort }
+
+static const struct hpd_state_desc hpd_states[] = {
+	[STATE_HPD_RESET] = {
+		.run = hpd_reset_state,
+		.exits = BIT(STATE_PLUG),
+		.on = { HPD_RESTART, HPD_RESTART },
+	},
+	[STATE_PLUG] = {
+		.run = hpd_plug_state,
+		.exits = BIT(STATE_CHECK_EDID) | BIT(STATE_DONE_DISABLED),
+		.on = { HPD_RESTART, HPD_RESTART },
+	},
+	[STATE_CHECK_EDID] = {
+		.run = edid_check_state,
+		.exits = BIT(STATE_CHECK_EDID) | BIT(STATE_LINK_TRAIN) |
+			BIT(STATE_MODESET) | BIT(STATE_DONE_ENABLED) |
+			BIT(STATE_DONE_DISABLED),
+		.on = { HPD_RESTART, HPD_RESTART },
+	},
+	[STATE_DONE_DISABLED] = {
+		.on = { HPD_RESTART, HPD_RESTART },
+	},
+	[STATE_DONE_ENABLED] = {
+		.run = done_enabled_state,
+		.exits = BIT(STATE_DONE_ENABLED) | BIT(STATE_HPD_RESET),
+		.on = {
+			/*
+			 * HPD dropped while we were in DONE_ENABLED. Hold
+			 * steady and wait to see if it comes back.
+			 */
+			[HPD_EVT_LOW] = { STATE_WAIT_FOR_HPD_REASSERT,
+					HPD_DELAY_DROP, hpd_evt_drop },
+			/* Looks like HPD dropped but came back quickly */
+			[HPD_EVT_HIGH] = { STATE_KEEP, HPD_DELAY_NONE,
+					hpd_evt_bounce },
+		},
+	},
+	[STATE_WAIT_FOR_HPD_REASSERT] = {
+		.run = wait_for_hpd_reassert_state,
+		.exits = BIT(STATE_HPD_RESET),
+		.on = {
+			[HPD_EVT_LOW] = HPD_RESTART,
+			/*
+			 * Looks like HPD dropped and eventually came back.
+			 * Re-read the EDID and reset the system only if the
+			 * EDID has changed.
+			 */
+			[HPD_EVT_HIGH] = { STATE_RECHECK_EDID,
+					HPD_DELAY_EDID, hpd_evt_reassert },
+		},
+	},
+	[STATE_RECHECK_EDID] = {
+		.run = edid_recheck_state,
+		.exits = BIT(STATE_RECHECK_EDID) | BIT(STATE_DONE_ENABLED) |
+			BIT(STATE_HPD_RESET),
+		.on = { HPD_RESTART, HPD_RESTART },
+	},
+	[STATE_INIT_FROM_BOOTLOADER] = {
+		.run = bootloader_takeover_state,
+		.exits = BIT(STATE_PLUG) | BIT(STATE_INIT_FROM_BOOTLOADER) |
+			BIT(STATE_DONE_ENABLED),
+		.on = {
+			[HPD_EVT_LOW] = HPD_RESTART,
+			/*
+			 * We follow the same protocol as STATE_HPD_RESET
+			 * but avoid actually entering that state so
+			 * we do not actively disable HPD. Worker will check
+			 * HPD level again when it's woke up after 40ms.
+			 */
+			[HPD_EVT_HIGH] = { STATE_PLUG, HPD_DELAY_STABILIZE,
+					hpd_evt_bootloader },
+		},
+	},
+	[STATE_LINK_TRAIN] = {
+		.run = link_train_state,
+		.exits = BIT(STATE_LINK_TRAIN) | BIT(STATE_MODESET) |
+			BIT(STATE_DONE_ENABLED) | BIT(STATE_DONE_DISABLED),
+		.on = { HPD_RESTART_STAGE, HPD_RESTART_STAGE },
+	},
+	[STATE_MODESET] = {
+		.run = modeset_state,
+		.exits = BIT(STATE_MODESET) | BIT(STATE_DONE_ENABLED) |
+			BIT(STATE_DONE_DISABLED),
+		.on = { HPD_RESTART_STAGE, HPD_RESTART_STAGE },
+	},
+};
+
+static_assert(ARRAY_SIZE(hpd_states) == HPD_STATE_COUNT);
+static_assert(ARRAY_SIZE(state_names) == HPD_STATE_COUNT);
+static_assert(ARRAY_SIZE(delay_names) == HPD_DELAY_COUNT);
+static_assert(HPD_STATE_COUNT <= BITS_PER_TYPE(unsigned int));
+
+static int hpd_evt_delay(struct hpd_data *data, int delay)
+{
+	switch (delay) {
+	case HPD_DELAY_STABILIZE:
+		return hpd_edge_delay(data, hpd_stabilize_ms(data));
+	case HPD_DELAY_DROP:
+		return hpd_edge_delay(data, hpd_drop_wait_ms(data));
+	case HPD_DELAY_EDID:
+		return edid_first_delay(data);
+	case HPD_DELAY_STEADY:
+		return hpd_steady_delay(data);
+	default:
+		return 0;
+	}
+}
+
+static void handle_hpd_evt(struct hpd_data *data, int cur_hpd, u32 head)
+{
+	struct hpd_transition t;
+	bool glitch = hpd_evt_is_glitch(data, cur_hpd, head);
+
+	data->evt_seen = head;
+
+	if (glitch) {
+		/*
+		 * Only short pulses since we settled and hpd is back where
+		 * it was. No need to sit through the stabilize delay.
+		 */
+		pr_debug("hpd: ignoring hpd glitch\n");
+		trace_hpd_bounce_ignored(data);
+		goto keep_state;
+	}
+
+	t = hpd_states[data->state].on[cur_hpd ? HPD_EVT_HIGH : HPD_EVT_LOW];
+	if (t.action)
+		t.action(data, cur_hpd, &t);
+	if (STATE_KEEP == t.target)
+		goto keep_state;
+
+	set_hpd_state(data, t.target, hpd_evt_delay(data, t.delay));
+	return;
+keep_state:
+	/* The event replaced a pending background edid verify, redo it */
+	if (data->edid_verify)
+		resched_hpd_work(data, 0);
+}
+
+static void hpd_power_get(struct hpd_data *data)
+{
+	if (data->powered)
+		return;
+
+	if (data->pm_dev && pm_runtime_resume_and_get(data->pm_dev) < 0) {
+		pr_warn("hpd: %s: runtime resume failed\n", data->name);
+		return;
+	}
+	if (data->ops->active)
+		data->ops->active(data->drv_data);
+	data->powered = true;
+}
+
+static void hpd_power_put(struct hpd_data *data)
+{
+	if (!data->powered)
+		return;
+
+	if (data->ops->idle)
+		data->ops->idle(data->drv_data);
+	if (data->pm_dev) {
+		pm_runtime_mark_last_busy(data->pm_dev);
+		pm_runtime_put_autosuspend(data->pm_dev);
+	}
+	data->powered = false;
+}
+
+static bool hpd_state_done(int state)
+{
+	return STATE_DONE_ENABLED == state || STATE_DONE_DISABLED == state;
+}
+
+/* Nothing left to do until the next hpd event */
+static bool hpd_settled(struct hpd_data *data)
+{
+	bool settled;
+
+	if (!hpd_state_done(data->state))
+		return false;
+
+	if (atomic_read(&data->pending_hpd_evt) ||
+		delayed_work_pending(&data->dwork))
+		return false;
+
+	hpd_lock(data);
+	settled = EDID_ASYNC_IDLE == data->edid_async &&
+		EDID_ASYNC_IDLE == data->edid_prefetch;
+	hpd_unlock(data);
+
+	return settled;
+}
+
+static void hpd_worker(struct work_struct *work)
+{
+	int pending_hpd_evt, cur_hpd;
+	u32 evt_head;
+	u64 start_ns = ktime_get_ns();
+	struct hpd_data *data = container_of(
+					to_delayed_work(work),
+					struct hpd_data, dwork);
+
+	/*
+	 * Observe and clear pending flag
+	 * and latch the current HPD state.
+	 */
+	hpd_power_get(data);
+	pending_hpd_evt = atomic_xchg(&data->pending_hpd_evt, 0);
+	data->work_gen = atomic_read(&data->evt_gen);
+	evt_head = atomic_read(&data->evt_head);
+	cur_hpd = hpd_get_level(data);
+
+	trace_hpd_worker(data, cur_hpd, pending_hpd_evt);
+	pr_debug("hpd: state %d (%s), hpd %d, pending_hpd_evt %d\n",
+		data->state, state_names[data->state],
+		cur_hpd, pending_hpd_evt);
+
+	if (pending_hpd_evt) {
+		/*
+		 * If we were woken up because of HPD activity, just schedule
+		 * the next appropriate task and get out.
+		 */
+		handle_hpd_evt(data, cur_hpd, evt_head);
+	} else if (hpd_state_done(data->state) && !data->edid_verify) {
+		/*
+		 * Nothing to run but a background edid verify. Woken up to
+		 * settle, e.g. by a late completion of a discarded edid read.
+		 */
+	} else if (data->state < ARRAY_SIZE(hpd_states)) {
+		void (*run)(struct hpd_data *data) =
+			hpd_states[data->state].run;
+
+		if (NULL == run) {
+			pr_warn("hpd: NULL state handler in state %d\n",
+				data->state);
+		} else {
+			data->state_ran = true;
+			run(data);
+		}
+	} else {
+		pr_warn("hpd: unexpected state scheduled %d",
+			data->state);
+	}
+
+	if (hpd_settled(data))
+		hpd_power_put(data);
+
+	start_ns = ktime_get_ns() - start_ns;
+	data->stats.worker_runs++;
+	data->stats.worker_ns += start_ns;
+	data->stats.worker_max_ns = max(data->stats.worker_max_ns, start_ns);
+}
+
+/*
+ * Connectors of a controller have timer expiries rounded up to a
+ * multiple of batch_ms, so that they get processed together.
+ */
+static unsigned long hpd_batch_delay(struct hpd_data *data,
+				unsigned long delay)
+{
+	unsigned long slot;
+
+	if (!data->ctrl || !delay)
+		return delay;
+
+	slot = msecs_to_jiffies(READ_ONCE(data->ctrl->batch_ms));
+	if (slot <= 1)
+		return delay;
+
+	return roundup(jiffies + delay, slot) - jiffies;
+}
+
+/*
+ * Cpu to queue the worker on. Resolved on every schedule, the irq
+ * affinity or cpu hotplug may have changed since the last one.
+ */
+static int hpd_work_cpu(struct hpd_data *data)
+{
+	const struct cpumask *mask;
+	int cpu;
+
+	if (data->flags & HPD_FLAG_CPU) {
+		cpu = data->cpu;
+	} else if (data->flags & HPD_FLAG_NUMA_NODE) {
+		if (data->numa_node < 0 || data->numa_node >= nr_node_ids)
+			return WORK_CPU_UNBOUND;
+		cpu = cpumask_any_and(cpumask_of_node(data->numa_node),
+			cpu_online_mask);
+	} else if (data->irq > 0) {
+		mask = irq_get_effective_affinity_mask(data->irq);
+		if (!mask)
+			return WORK_CPU_UNBOUND;
+		cpu = cpumask_any_and(mask, cpu_online_mask);
+	} else {
+		return WORK_CPU_UNBOUND;
+	}
+
+	if (cpu < 0 || cpu >= nr_cpu_ids || !cpu_online(cpu))
+		return WORK_CPU_UNBOUND;
+
+	return cpu;
+}
+
+/* Safe to call from any context */
+static void sched_hpd_work(struct hpd_data *data, int resched_time)
+{
+	if (resched_time >= 0 && !READ_ONCE(data->shutdown) &&
+		!READ_ONCE(data->suspended)) {
+		atomic_inc(&data->stats.work_mods);
+		mod_delayed_work_on(hpd_work_cpu(data), data->wq,
+			&data->dwork,
+			hpd_batch_delay(data, msecs_to_jiffies(resched_time)));
+	} else {
+		atomic_inc(&data->stats.work_cancels);
+		cancel_delayed_work(&data->dwork);
+	}
+}
+
+/*
+ * Reschedule the worker unless an hpd event is pending, in which case
+ * the worker is already due to run immediately.
+ */
+static void resched_hpd_work(struct hpd_data *data, int resched_time)
+{
+	if (atomic_read(&data->pending_hpd_evt))
+		return;
+
+	sched_hpd_work(data, resched_time);
+
+	/*
+	 * hpd_set_pending_evt() doesn't serialize against us. If it raised
+	 * an event while we were rescheduling, make sure the worker still
+	 * runs right away instead of after @resched_time.
+	 */
+	smp_mb();
+	if (atomic_read(&data->pending_hpd_evt))
+		sched_hpd_work(data, 0);
+}
+
+/*
+ * Take ddc bus for edid access. If busy, return false and with @wait
+ * queue up; worker is woken up when the bus is released.
+ */
+static bool hpd_bus_acquire(struct hpd_data *data, bool wait)
+{
+	struct hpd_bus *bus = data->bus;
+	bool acquired = true;
+
+	if (!bus)
+		return true;
+
+	spin_lock(&bus->lock);
+	if (!bus->owner || bus->owner == data) {
+		bus->owner = data;
+	} else {
+		acquired = false;
+		if (wait && list_empty(&data->bus_node))
+			list_add_tail(&data->bus_node, &bus->waiters);
+	}
+	spin_unlock(&bus->lock);
+
+	return acquired;
+}
+
+/* Release ddc bus or give up waiting for it */
+static void hpd_bus_release(struct hpd_data *data)
+{
+	struct hpd_bus *bus = data->bus;
+	struct hpd_data *waiter, *tmp;
+
+	if (!bus)
+		return;
+
+	spin_lock(&bus->lock);
+	list_del_init(&data->bus_node);
+	if (bus->owner == data) {
+		bus->owner = NULL;
+
+		/* Let all waiters race for the bus, losers queue up again */
+		list_for_each_entry_safe(waiter, tmp, &bus->waiters,
+					bus_node) {
+			list_del_init(&waiter->bus_node);
+			resched_hpd_work(waiter, 0);
+		}
+	}
+	spin_unlock(&bus->lock);
+}
+
+static void hpd_bus_init(struct hpd_bus *bus, int id)
+{
+	spin_lock_init(&bus->lock);
+	bus->owner = NULL;
+	INIT_LIST_HEAD(&bus->waiters);
+	bus->id = id;
+	bus->users = 0;
+}
+
+static struct hpd_bus *hpd_bus_get(int id)
+{
+	struct hpd_bus *bus;
+
+	mutex_lock(&hpd_buses_lock);
+	list_for_each_entry(bus, &hpd_buses, node)
+		if (bus->id == id)
+			goto found;
+
+	bus = kzalloc(sizeof(*bus), GFP_KERNEL);
+	if (!bus)
+		goto unlock;
+	hpd_bus_init(bus, id);
+	list_add(&bus->node, &hpd_buses);
+found:
+	bus->users++;
+unlock:
+	mutex_unlock(&hpd_buses_lock);
+
+	return bus;
+}
+
+static void hpd_bus_put(struct hpd_bus *bus)
+{
+	mutex_lock(&hpd_buses_lock);
+	if (!--bus->users) {
+		list_del(&bus->node);
+		kfree(bus);
+	}
+	mutex_unlock(&hpd_buses_lock);
+}
+
+/*
+ * Returns false if the switch was dropped as stale, a newer hpd event is
+ * then due to be handled instead.
+ */
+static bool set_hpd_state(struct hpd_data *data,
+			int target_state, int resched_time)
+{
+	hpd_lock(data);
+
+	if (hpd_evt_stale(data)) {
+		pr_debug("hpd: dropping stale switch to state %d (%s)\n",
+			target_state, state_names[target_state]);
+		hpd_unlock(data);
+		return false;
+	}
+
+	if (target_state == data->state && !data->state_ran) {
+		/*
+		 * Still waiting to run this state e.g. an event burst within
+		 * the stabilize window. Nothing changes but the timer.
+		 */
+		data->stats.transitions_coalesced++;
+		resched_hpd_work(data, resched_time);
+		hpd_unlock(data);
+		return true;
+	}
+
+	trace_hpd_state_switch(data, target_state, resched_time);
+	pr_debug("hpd: switching from state %d (%s) to state %d (%s)\n",
+		data->state, state_names[data->state],
+		target_state, state_names[target_state]);
+	hpd_stats_switch(data, target_state);
+	data->state = target_state;
+	data->state_ran = false;
+	hpd_status_publish(data);
+
+	/*
+	 * Leaving CHECK_EDID drops any edid read still in flight. The new
+	 * state is scheduled on its own, it doesn't wait for the read.
+	 */
+	if (EDID_ASYNC_WAIT == data->edid_async ||
+		(EDID_ASYNC_BUSY == data->edid_async &&
+		STATE_CHECK_EDID != target_state))
+		data->edid_async = EDID_ASYNC_DISCARD;
+	else if (STATE_CHECK_EDID != target_state &&
+		EDID_ASYNC_DISCARD != data->edid_async)
+		data->edid_async = EDID_ASYNC_IDLE;
+
+	/* Ddc bus stays taken only while an edid read is in flight */
+	if (!edid_in_flight(data->edid_async) &&
+		!edid_in_flight(data->edid_prefetch))
+		hpd_bus_release(data);
+
+	if (STATE_DONE_ENABLED != target_state)
+		data->edid_verify = false;
+
+	if (STATE_DONE_ENABLED == target_state ||
+		STATE_DONE_DISABLED == target_state) {
+		int connected = STATE_DONE_ENABLED == target_state;
+
+		/* First change opens the batch window, others join it */
+		if (data->notify_connected != connected) {
+			data->notify_connected = connected;
+			schedule_delayed_work(&hpd_notify_work,
+				msecs_to_jiffies(READ_ONCE(notify_batch_ms)));
+		}
+	}
+
+	/*
+	 * Sink is gone or unusable, cached edid is kept for next plug. So is
+	 * its hint, but a sink plugged next doesn't start from it.
+	 */
+	if (STATE_DONE_DISABLED == target_state) {
+		hpd_edid_set(data, NULL);
+		data->sink_id = 0;
+	}
+
+	/*
+	 * If the pending_hpd_evt flag is already set, don't bother to
+	 * reschedule the state machine worker.  We should be able to assert
+	 * that there is a worker callback already scheduled, and that it is
+	 * scheduled to run immediately. This is particularly important when
+	 * making the transition to the steady state ENABLED or DISABLED states.
+	 * If an HPD event occurs while the worker is in flight, after the
+	 * worker checks the state of the pending HPD flag, and then the state
+	 * machine transitions to ENABLE or DISABLED, the system would end up
+	 * canceling the callback to handle the HPD event were it not for this
+	 * check.
+	 */
+	resched_hpd_work(data, resched_time);
+
+	hpd_unlock(data);
+
+	return true;
+}
+
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *hpd_debugfs_root;
+static int hpd_debugfs_users;
+static DEFINE_MUTEX(hpd_debugfs_lock);
+
+static void hpd_lat_show(struct seq_file *s, const char *name,
+			struct hpd_latency *lat)
+{
+	int i;
+
+	seq_printf(s, "%s: count %u", name, lat->count);
+	if (lat->count)
+		seq_printf(s, " min %llu avg %llu max %llu us",
+			div_u64(lat->min_ns, NSEC_PER_USEC),
+			div_u64(div_u64(lat->total_ns, lat->count),
+				NSEC_PER_USEC),
+			div_u64(lat->max_ns, NSEC_PER_USEC));
+	seq_puts(s, "\n  hist(ms)");
+	for (i = 0; i < HPD_LAT_BUCKETS; i++)
+		seq_printf(s, " <%lu:%u", BIT(i), lat->hist[i]);
+	seq_puts(s, "\n");
+}
+
+static int hpd_stats_show(struct seq_file *s, void *unused)
+{
+	struct hpd_data *data = s->private;
+	struct hpd_stats *stats = &data->stats;
+	u64 now = ktime_get_ns();
+	int i;
+
+	hpd_lock(data);
+
+	seq_printf(s, "state: %d (%s) for %llu us\n",
+		data->state, state_names[data->state],
+		div_u64(now - stats->state_enter_ns[data->state],
+			NSEC_PER_USEC));
+	for (i = 0; i < HPD_STATE_COUNT; i++) {
+		u64 ns = stats->state_time_ns[i];
+
+		if (i == data->state)
+			ns += now - stats->state_enter_ns[i];
+		seq_printf(s, "%-24s entries %u time %llu us\n",
+			state_names[i], stats->state_entries[i],
+			div_u64(ns, NSEC_PER_USEC));
+	}
+	hpd_lat_show(s, "evt_to_edid_ready", &stats->evt_to_ready);
+	hpd_lat_show(s, "evt_to_disable", &stats->evt_to_disable);
+	seq_printf(s, "edid_retries: %u\nedid_failures: %u\n",
+		stats->edid_retries, stats->edid_failures);
+	seq_printf(s, "edid_cache_hits: %u\nedid_cache_misses: %u\n",
+		stats->edid_cache_hits, stats->edid_cache_misses);
+	seq_printf(s, "transitions_coalesced: %u\ndisables_skipped: %u\n",
+		stats->transitions_coalesced, stats->disables_skipped);
+	seq_printf(s, "edid_prefetch_hits: %u\nedid_prefetch_discards: %u\n",
+		stats->edid_prefetch_hits, stats->edid_prefetch_discards);
+	seq_printf(s, "disable_calls: %u\nedid_ready_calls: %u\n",
+		stats->disable_calls, stats->edid_ready_calls);
+	seq_printf(s, "ddc_reads: %u\n", stats->ddc_reads);
+	seq_printf(s, "evts_raised: %d\nevts_merged: %d\n",
+		atomic_read(&stats->evts_raised),
+		atomic_read(&stats->evts_merged));
+	seq_printf(s, "work_mods: %d\nwork_cancels: %d\n",
+		atomic_read(&stats->work_mods),
+		atomic_read(&stats->work_cancels));
+	seq_printf(s, "worker_runs: %u avg %llu max %llu us\n",
+		stats->worker_runs,
+		stats->worker_runs ? div_u64(div_u64(stats->worker_ns,
+				stats->worker_runs), NSEC_PER_USEC) : 0,
+		div_u64(stats->worker_max_ns, NSEC_PER_USEC));
+	seq_printf(s, "lock_contended: %u\n", stats->lock_contended);
+	seq_printf(s, "drop_learned_waits: %u\ndrop_mispredictions: %u\n",
+		stats->drop_learned_waits, stats->drop_mispredictions);
+	seq_printf(s, "stale_dropped: %u\n", stats->stale_dropped);
+
+	hpd_unlock(data);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(hpd_stats);
+
+static int hpd_events_show(struct seq_file *s, void *unused)
+{
+	struct hpd_data *data = s->private;
+	u32 head = atomic_read(&data->evt_head);
+	u32 seq = head > HPD_EVT_RING_SIZE ? head - HPD_EVT_RING_SIZE + 1 : 1;
+	struct hpd_edge edge;
+
+	for (; seq != head + 1; seq++)
+		if (hpd_evt_get(data, seq, &edge))
+			seq_printf(s, "%u %llu hpd %d state %d (%s)\n",
+				edge.seq, edge.ts_ns, edge.level,
+				edge.state, state_names[edge.state]);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(hpd_events);
+
+static int hpd_stats_reset(void *arg, u64 val)
+{
+	struct hpd_data *data = arg;
+	u64 evt_ns;
+
+	hpd_lock(data);
+	evt_ns = atomic64_read(&data->stats.evt_ns);
+	memset(&data->stats, 0, sizeof(data->stats));
+	data->stats.state_enter_ns[data->state] = ktime_get_ns();
+	atomic64_set(&data->stats.evt_ns, evt_ns);
+	hpd_unlock(data);
+
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(hpd_stats_reset_fops, NULL, hpd_stats_reset, "%llu\n");
+
+static void hpd_debugfs_timing(struct hpd_data *data)
+{
+	struct hpd_timing *timing = &data->timing;
+	struct dentry *dir = debugfs_create_dir("timing", data->debugfs);
+
+	debugfs_create_u32("stabilize_ms", 0644, dir, &timing->stabilize_ms);
+	debugfs_create_u32("drop_timeout_ms", 0644, dir,
+			&timing->drop_timeout_ms);
+	debugfs_create_u32("check_plug_delay_ms", 0644, dir,
+			&timing->check_plug_delay_ms);
+	debugfs_create_u32("edid_timeout_ms", 0644, dir,
+			&timing->edid_timeout_ms);
+	debugfs_create_u32("min_pulse_us", 0644, dir, &timing->min_pulse_us);
+	debugfs_create_u32("edid_initial_delay_ms", 0644, dir,
+			&timing->edid_retry.initial_delay_ms);
+	debugfs_create_u32("edid_multiplier_pct", 0644, dir,
+			&timing->edid_retry.multiplier_pct);
+	debugfs_create_u32("edid_max_delay_ms", 0644, dir,
+			&timing->edid_retry.max_delay_ms);
+	debugfs_create_u32("edid_max_attempts", 0644, dir,
+			&timing->edid_retry.max_attempts);
+	debugfs_create_u32("stage_timeout_ms", 0644, dir,
+			&timing->stage_timeout_ms);
+	debugfs_create_u32("drop_margin_ms", 0644, dir,
+			&timing->drop_margin_ms);
+}
+
+/* State graph in graphviz dot format, timer transitions in dashed lines */
+static int hpd_graph_show(struct seq_file *s, void *unused)
+{
+	int i, j;
+
+	seq_puts(s, "digraph hpd {\n");
+	for (i = 0; i < HPD_STATE_COUNT; i++) {
+		const struct hpd_state_desc *desc = &hpd_states[i];
+
+		for (j = 0; j < HPD_STATE_COUNT; j++) {
+			if (desc->exits & BIT(j))
+				seq_printf(s,
+					"\t\"%s\" -> \"%s\" [style=dashed];\n",
+					state_names[i], state_names[j]);
+		}
+
+		for (j = 0; j < HPD_EVT_COUNT; j++) {
+			const struct hpd_transition *t = &desc->on[j];
+			int target = STATE_KEEP == t->target ? i : t->target;
+
+			seq_printf(s, "\t\"%s\" -> \"%s\"",
+				state_names[i], state_names[target]);
+			seq_printf(s, " [label=\"hpd %s%s\"];\n",
+				HPD_EVT_HIGH == j ? "high" : "low",
+				delay_names[t->delay]);
+		}
+	}
+	seq_puts(s, "}\n");
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(hpd_graph);
+
+static int hpd_quirks_show(struct seq_file *s, void *unused)
+{
+	struct hpd_quirk_entry *entry;
+
+	mutex_lock(&hpd_quirks_lock);
+	list_for_each_entry(entry, &hpd_quirks, node) {
+		const struct hpd_quirk *quirk = &entry->quirk;
+
+		seq_printf(s, "%04x %04x %u %u %u %u %u %u\n",
+			quirk->vendor, quirk->product, quirk->stabilize_ms,
+			quirk->drop_timeout_ms,
+			quirk->edid_retry.initial_delay_ms,
+			quirk->edid_retry.multiplier_pct,
+			quirk->edid_retry.max_delay_ms,
+			quirk->edid_retry.max_attempts);
+	}
+	mutex_unlock(&hpd_quirks_lock);
+
+	return 0;
+}
+
+static int hpd_quirks_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hpd_quirks_show, NULL);
+}
+
+static void hpd_quirks_clear(void)
+{
+	struct hpd_quirk_entry *entry, *tmp;
+
+	mutex_lock(&hpd_quirks_lock);
+	list_for_each_entry_safe(entry, tmp, &hpd_quirks, node) {
+		list_del(&entry->node);
+		kfree(entry);
+	}
+	mutex_unlock(&hpd_quirks_lock);
+}
+
+static ssize_t hpd_quirks_write(struct file *file, const char __user *ubuf,
+				size_t count, loff_t *ppos)
+{
+	struct hpd_quirk quirk;
+	char *buf, *p, *line;
+	int ret = 0;
+
+	if (count > PAGE_SIZE)
+		return -E2BIG;
+
+	buf = memdup_user_nul(ubuf, count);
+	if (IS_ERR(buf))
+		return PTR_ERR(buf);
+
+	if (sysfs_streq(buf, "clear")) {
+		hpd_quirks_clear();
+		goto out;
+	}
+
+	p = buf;
+	while ((line = strsep(&p, "\n")) && !ret) {
+		if (!*line)
+			continue;
+
+		memset(&quirk, 0, sizeof(quirk));
+		if (sscanf(line, "%hx %hx %u %u %u %u %u %u",
+				&quirk.vendor, &quirk.product,
+				&quirk.stabilize_ms, &quirk.drop_timeout_ms,
+				&quirk.edid_retry.initial_delay_ms,
+				&quirk.edid_retry.multiplier_pct,
+				&quirk.edid_retry.max_delay_ms,
+				&quirk.edid_retry.max_attempts) < 4)
+			ret = -EINVAL;
+		else
+			ret = hpd_quirk_add(&quirk);
+	}
+out:
+	kfree(buf);
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations hpd_quirks_fops = {
+	.owner = THIS_MODULE,
+	.open = hpd_quirks_open,
+	.read = seq_read,
+	.write = hpd_quirks_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/*
+ * Replay of a recorded hpd edge trace, written to hpd/<name>/replay as
+ * "<delay_ms> <level>" pairs. Each edge is reported with hpd_report_evt()
+ * delay_ms after the previous one, so the stats of a scenario can be
+ * compared across timing policies without replugging a panel.
+ */
+#define HPD_REPLAY_MAX_STEPS 256
+
+struct hpd_replay_step {
+	u32 delay_ms;
+	bool level;
+};
+
+struct hpd_replay {
+	struct delayed_work work;
+	struct hpd_data *data;
+	int len;
+	int pos;
+	struct hpd_replay_step step[];
+};
+
+static void hpd_replay_worker(struct work_struct *work)
+{
+	struct hpd_replay *replay = container_of(to_delayed_work(work),
+					struct hpd_replay, work);
+
+	hpd_report_evt(replay->data, replay->step[replay->pos++].level,
+		ktime_get());
+	if (replay->pos < replay->len)
+		schedule_delayed_work(&replay->work,
+			msecs_to_jiffies(replay->step[replay->pos].delay_ms));
+}
+
+/* Serializes replay start and stop, hpd_data.replay is protected by it */
+static DEFINE_MUTEX(hpd_replay_lock);
+
+/* Called with hpd_replay_lock held */
+static void __hpd_replay_stop(struct hpd_data *data)
+{
+	struct hpd_replay *replay = data->replay;
+
+	data->replay = NULL;
+	if (replay) {
+		cancel_delayed_work_sync(&replay->work);
+		kfree(replay);
+	}
+}
+
+static void hpd_replay_stop(struct hpd_data *data)
+{
+	mutex_lock(&hpd_replay_lock);
+	__hpd_replay_stop(data);
+	mutex_unlock(&hpd_replay_lock);
+}
+
+static ssize_t hpd_replay_write(struct file *file, const char __user *ubuf,
+				size_t count, loff_t *ppos)
+{
+	struct hpd_data *data = file->private_data;
+	struct hpd_replay *replay;
+	char *buf, *p;
+	u32 delay_ms;
+	int level, n;
+
+	if (count > PAGE_SIZE)
+		return -E2BIG;
+
+	buf = memdup_user_nul(ubuf, count);
+	if (IS_ERR(buf))
+		return PTR_ERR(buf);
+
+	replay = kzalloc(struct_size(replay, step, HPD_REPLAY_MAX_STEPS),
+			GFP_KERNEL);
+	if (!replay) {
+		kfree(buf);
+		return -ENOMEM;
+	}
+
+	for (p = buf; sscanf(p, "%u %d%n", &delay_ms, &level, &n) == 2;
+		p += n) {
+		if (replay->len == HPD_REPLAY_MAX_STEPS) {
+			kfree(replay);
+			kfree(buf);
+			return -E2BIG;
+		}
+		replay->step[replay->len].delay_ms = delay_ms;
+		replay->step[replay->len].level = !!level;
+		replay->len++;
+	}
+	kfree(buf);
+
+	/* An empty write just stops the replay in progress */
+	mutex_lock(&hpd_replay_lock);
+	__hpd_replay_stop(data);
+	if (replay->len) {
+		replay->data = data;
+		INIT_DELAYED_WORK(&replay->work, hpd_replay_worker);
+		data->replay = replay;
+		schedule_delayed_work(&replay->work,
+			msecs_to_jiffies(replay->step[0].delay_ms));
+	} else {
+		kfree(replay);
+	}
+	mutex_unlock(&hpd_replay_lock);
+
+	return count;
+}
+
+static const struct file_operations hpd_replay_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = hpd_replay_write,
+	.llseek = noop_llseek,
+};
+
+static void hpd_debugfs_init(struct hpd_data *data)
+{
+	mutex_lock(&hpd_debugfs_lock);
+	if (!hpd_debugfs_users++) {
+		hpd_debugfs_root = debugfs_create_dir("hpd", NULL);
+		debugfs_create_file("graph", 0444, hpd_debugfs_root, NULL,
+				&hpd_graph_fops);
+		debugfs_create_file("quirks", 0644, hpd_debugfs_root, NULL,
+				&hpd_quirks_fops);
+	}
+	mutex_unlock(&hpd_debugfs_lock);
+
+	data->debugfs = debugfs_create_dir(data->name, hpd_debugfs_root);
+	debugfs_create_file("stats", 0444, data->debugfs, data,
+			&hpd_stats_fops);
+	debugfs_create_file("events", 0444, data->debugfs, data,
+			&hpd_events_fops);
+	debugfs_create_file_unsafe("stats_reset", 0200, data->debugfs, data,
+			&hpd_stats_reset_fops);
+	debugfs_create_file("replay", 0200, data->debugfs, data,
+			&hpd_replay_fops);
+	hpd_debugfs_timing(data);
+}
+
+static void hpd_debugfs_remove(struct hpd_data *data)
+{
+	debugfs_remove_recursive(data->debugfs);
+	data->debugfs = NULL;
+	hpd_replay_stop(data);
+
+	mutex_lock(&hpd_debugfs_lock);
+	if (!--hpd_debugfs_users) {
+		debugfs_remove_recursive(hpd_debugfs_root);
+		hpd_debugfs_root = NULL;
+	}
+	mutex_unlock(&hpd_debugfs_lock);
+}
+#else
+static inline void hpd_debugfs_init(struct hpd_data *data) {}
+static inline void hpd_debugfs_remove(struct hpd_data *data) {}
+#endif
+
+static void edid_cache_free(struct hpd_data *data)
+{
+	struct hpd_edid *edid, *tmp;
+
+	hpd_lock(data);
+	hpd_edid_set(data, NULL);
+	list_for_each_entry_safe(edid, tmp, &data->edid_cache, node) {
+		list_del(&edid->node);
+		hpd_edid_put(edid);
+	}
+	data->edid_cache_len = 0;
+	hpd_unlock(data);
+}
+
+struct hpd_notify_file {
+	u32 seq;	/* last sequence read in full */
+	u32 shown;	/* sequence of the text being read */
+};
+
+/* Built on every read from the start, so it lists instances added since */
+static int hpd_notify_show(struct seq_file *s, void *unused)
+{
+	struct hpd_notify_file *nf = s->private;
+	struct hpd_data *data;
+
+	nf->shown = atomic_read(&hpd_notify_seq);
+	seq_printf(s, "seq %u\n", nf->shown);
+
+	mutex_lock(&hpd_instances_lock);
+	list_for_each_entry(data, &hpd_instances, instance_node) {
+		int state = READ_ONCE(data->state);
+
+		seq_printf(s, "%s %d %s\n", data->name,
+			data->notify_connected == 1, state_names[state]);
+	}
+	mutex_unlock(&hpd_instances_lock);
+
+	return 0;
+}
+
+static int hpd_notify_open(struct inode *inode, struct file *file)
+{
+	struct hpd_notify_file *nf;
+	int ret;
+
+	nf = kzalloc(sizeof(*nf), GFP_KERNEL);
+	if (!nf)
+		return -ENOMEM;
+
+	nf->seq = atomic_read(&hpd_notify_seq);
+	ret = single_open(file, hpd_notify_show, nf);
+	if (ret)
+		kfree(nf);
+
+	return ret;
+}
+
+static ssize_t hpd_notify_read(struct file *file, char __user *ubuf,
+			size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct hpd_notify_file *nf = s->private;
+	ssize_t ret;
+
+	ret = seq_read(file, ubuf, count, ppos);
+
+	/* Seen once a read returned the last of it, not on a read at EOF */
+	if (ret > 0 && !s->count)
+		nf->seq = nf->shown;
+
+	return ret;
+}
+
+static __poll_t hpd_notify_poll(struct file *file, poll_table *wait)
+{
+	struct seq_file *s = file->private_data;
+	struct hpd_notify_file *nf = s->private;
+
+	poll_wait(file, &hpd_notify_wait, wait);
+
+	if (atomic_read(&hpd_notify_seq) != nf->seq)
+		return EPOLLIN | EPOLLRDNORM;
+
+	return 0;
+}
+
+static int hpd_notify_release(struct inode *inode, struct file *file)
+{
+	struct seq_file *s = file->private_data;
+
+	kfree(s->private);
+
+	return single_release(inode, file);
+}
+
+static const struct file_operations hpd_notify_fops = {
+	.owner = THIS_MODULE,
+	.open = hpd_notify_open,
+	.read = hpd_notify_read,
+	.poll = hpd_notify_poll,
+	.release = hpd_notify_release,
+	.llseek = seq_lseek,
+};
+
+static struct miscdevice hpd_miscdev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "hpd",
+	.fops = &hpd_notify_fops,
+	.mode = 0444,
+};
+
+static bool hpd_miscdev_registered;
+
+static void hpd_notify_add(struct hpd_data *data)
+{
+	data->notify_connected = -1;
+
+	mutex_lock(&hpd_instances_lock);
+	if (list_empty(&hpd_instances)) {
+		hpd_miscdev_registered = !misc_register(&hpd_miscdev);
+		if (!hpd_miscdev_registered)
+			pr_warn("hpd: failed to register /dev/hpd\n");
+	}
+	list_add_tail(&data->instance_node, &hpd_instances);
+	mutex_unlock(&hpd_instances_lock);
+}
+
+static void hpd_notify_remove(struct hpd_data *data)
+{
+	mutex_lock(&hpd_instances_lock);
+	list_del(&data->instance_node);
+	if (list_empty(&hpd_instances)) {
+		if (hpd_miscdev_registered)
+			misc_deregister(&hpd_miscdev);
+		hpd_miscdev_registered = false;
+		cancel_delayed_work_sync(&hpd_notify_work);
+	}
+	mutex_unlock(&hpd_instances_lock);
+}
+
+void hpd_shutdown(struct hpd_data *data)
+{
+	data->shutdown = 1;
+	cancel_delayed_work_sync(&data->dwork);
+	hpd_stage_abort(data);
+	hpd_debugfs_remove(data);
+	hpd_notify_remove(data);
+	hpd_power_put(data);
+	
+	if (data->ops->shutdown)
+		data->ops->shutdown(data->drv_data);
 
-static const char * const state_names[] = {
-	"Reset",
-	"Check Plug",
-	"Check EDID",
-	"Disabled",
-	"Enabled",
-	"Wait for HPD reassert",
-	"Recheck EDID",
-	"Takeover from bootloader",
-};
+	edid_cache_free(data);
+	hpd_bus_release(data);
+	if (data->bus && data->bus->id >= 0)
+		hpd_bus_put(data->bus);
+	data->bus = NULL;
 
-static void set_hpd_state(struct hpd_data *data,
-			int target_state, int resched_time);
+	if (data->ctrl) {
+		mutex_lock(&data->ctrl->lock);
+		list_del(&data->ctrl_node);
+		mutex_unlock(&data->ctrl->lock);
+	}
 
-static void hpd_disable(struct hpd_data *data)
+	if (data->own_wq) {
+		destroy_workqueue(data->wq);
+		data->wq = NULL;
+		data->own_wq = false;
+	}
+
+	hpd_unbind_unused_ops(data);
+}
+
+static void hpd_raise_evt(struct hpd_data *data, int level, u64 ts_ns)
 {
-	if (data->ops->disable)
-		data->ops->disable(data->drv_data);
+	hpd_evt_record(data, level, ts_ns);
+	atomic64_cmpxchg(&data->stats.evt_ns, 0, ktime_get_ns());
+
+	/*
+	 * We always schedule work any time there is a pending HPD event.
+	 * If one is pending still, whoever raised it schedules the work, so
+	 * an event storm doesn't hammer the workqueue.
+	 */
+	atomic_inc(&data->stats.evts_raised);
+	atomic_inc(&data->evt_gen);
+	if (atomic_xchg(&data->pending_hpd_evt, 1)) {
+		atomic_inc(&data->stats.evts_merged);
+		return;
+	}
+	sched_hpd_work(data, 0);
 }
 
-static void hpd_reset_state(struct hpd_data *data)
+void hpd_suspend(struct hpd_data *data)
 {
+	WRITE_ONCE(data->suspended, 1);
+	cancel_delayed_work_sync(&data->dwork);
+	hpd_stage_abort(data);
+
 	/*
-	 * Shut everything down, then schedule a
-	 * check of the plug state in the near future.
+	 * Edid reads don't survive suspend, redone on resume. One still in
+	 * flight keeps the ddc bus until reported, as on leaving CHECK_EDID,
+	 * and its result is dropped.
 	 */
-	hpd_disable(data);
-	set_hpd_state(data, STATE_PLUG,
-			CHECK_PLUG_STATE_DELAY_MS);
+	hpd_lock(data);
+	data->edid_async = edid_in_flight(data->edid_async) ?
+		EDID_ASYNC_DISCARD : EDID_ASYNC_IDLE;
+	data->edid_prefetch = edid_in_flight(data->edid_prefetch) ?
+		EDID_ASYNC_DISCARD : EDID_ASYNC_IDLE;
+	if (!edid_in_flight(data->edid_async) &&
+		!edid_in_flight(data->edid_prefetch))
+		hpd_bus_release(data);
+	hpd_unlock(data);
+
+	hpd_power_put(data);
+	pr_debug("hpd: %s: suspended in state %d (%s)\n", data->name,
+		data->state, state_names[data->state]);
 }
 
-static void hpd_plug_state(struct hpd_data *data)
+void hpd_resume(struct hpd_data *data)
 {
-	if (data->ops->get_hpd_state(data->drv_data)) {
-		/*
-		 * Looks like there is something plugged in.
-		 * Get ready to read the sink's EDID information.
-		 */
-		data->edid_reads = 0;
+	/*
+	 * An enabled sink is kept if hpd is still high: the event is then
+	 * ignored as a bounce and the edid verified in DONE_ENABLED.
+	 * Otherwise the event restarts the state machine as usual.
+	 */
+	hpd_lock(data);
+	if (STATE_DONE_ENABLED == data->state)
+		data->edid_verify = true;
+	hpd_unlock(data);
 
-		set_hpd_state(data, STATE_CHECK_EDID,
-				CHECK_EDID_DELAY_MS);
-	} else {
-		/*
-		 * Nothing plugged in, so we are finished. Go to the
-		 * DONE_DISABLED state and stay there until the next HPD event.
-		 */
-		hpd_disable(data);
-		set_hpd_state(data, STATE_DONE_DISABLED, -1);
-	}
+	/* Reported level is stale, poll until the next hpd_report_evt() */
+	atomic_set(&data->hpd_level, -1);
+	WRITE_ONCE(data->suspended, 0);
+	smp_mb();
+
+	/* Events raised while suspended never got the work scheduled */
+	atomic_set(&data->pending_hpd_evt, 0);
+	hpd_raise_evt(data, -1, ktime_get_ns());
 }
 
-static void edid_check_state(struct hpd_data *data)
+void hpd_set_pending_evt(struct hpd_data *data)
 {
-	if (!data->ops->get_hpd_state(data->drv_data)) {
-		/* hpd dropped - stop EDID read */
-		pr_info("hpd: dropped, abort EDID read\n");
-		goto end_disabled;
+	/* No level reported, fall back to polling */
+	atomic_set(&data->hpd_level, -1);
+	hpd_raise_evt(data, -1, ktime_get_ns());
+}
+
+void hpd_report_evt(struct hpd_data *data, bool level, ktime_t timestamp)
+{
+	atomic64_set(&data->hpd_edge_ns, ktime_to_ns(timestamp));
+	smp_wmb();
+	atomic_set(&data->hpd_level, level);
+	hpd_raise_evt(data, level, ktime_to_ns(timestamp));
+}
+
+void hpd_stage_done(struct hpd_data *data, bool ok)
+{
+	hpd_lock(data);
+
+	if (EDID_ASYNC_BUSY == data->stage) {
+		data->stage = ok ? EDID_ASYNC_OK : EDID_ASYNC_FAILED;
+		resched_hpd_work(data, 0);
 	}
 
-	if (!data->ops->edid_read(data->drv_data)) {
-		/*
-		 * Failed to read EDID. If we still have retry attempts left,
-		 * schedule another attempt. Otherwise give up and just go to
-		 * the disabled state.
-		 */
-		data->edid_reads++;
-		if (data->edid_reads >= MAX_EDID_READ_ATTEMPTS) {
-			pr_info("hpd: EDID read failed %d times. Giving up.\n",
-				data->edid_reads);
-			goto end_disabled;
-		} else {
-			set_hpd_state(data, STATE_CHECK_EDID,
-					CHECK_EDID_DELAY_MS);
-		}
+	hpd_unlock(data);
+}
 
-		return;
+void hpd_edid_read_done(struct hpd_data *data, bool ok)
+{
+	hpd_lock(data);
+
+	if (EDID_ASYNC_BUSY == data->edid_async) {
+		data->edid_async = ok ? EDID_ASYNC_OK : EDID_ASYNC_FAILED;
+
+		/* Don't wait for the timeout, process result right away */
+		resched_hpd_work(data, 0);
+	} else if (EDID_ASYNC_DISCARD == data->edid_async ||
+		EDID_ASYNC_WAIT == data->edid_async) {
+		/* Timed out or dropped read, only the ddc bus is left */
+		hpd_bus_release(data);
+		if (EDID_ASYNC_WAIT == data->edid_async ||
+			hpd_state_done(data->state))
+			resched_hpd_work(data, 0);
+		data->edid_async = EDID_ASYNC_IDLE;
+	} else if (EDID_ASYNC_BUSY == data->edid_prefetch) {
+		/* Kept for the PLUG state, which runs on its own schedule */
+		data->edid_prefetch = ok ? EDID_ASYNC_OK : EDID_ASYNC_FAILED;
+		hpd_bus_release(data);
+	} else if (EDID_ASYNC_DISCARD == data->edid_prefetch) {
+		data->edid_prefetch = EDID_ASYNC_IDLE;
+		hpd_bus_release(data);
+
+		/* The worker kept power for this read, let it settle now */
+		if (hpd_state_done(data->state))
+			resched_hpd_work(data, 0);
 	}
 
-	if (data->ops->edid_ready)
-		data->ops->edid_ready(data->drv_data);
+	hpd_unlock(data);
+}
 
+struct hpd_edid *hpd_edid_alloc(size_t len)
+{
+	struct hpd_edid *edid;
 
-	set_hpd_state(data, STATE_DONE_ENABLED, -1);
+	edid = kmalloc(struct_size(edid, blob, len), GFP_KERNEL);
+	if (!edid)
+		return NULL;
 
-	return;
-end_disabled:
-	hpd_disable(data);
-	set_hpd_state(data, STATE_DONE_DISABLED, -1);
+	INIT_LIST_HEAD(&edid->node);
+	kref_init(&edid->ref);
+	edid->key = 0;
+	edid->len = len;
+
+	return edid;
 }
 
-static void wait_for_hpd_reassert_state(struct hpd_data *data)
+/*
+ * Make the cached edid equal to @blob the known edid. Returns false if
+ * there is none. Called with data->lock held.
+ */
+static bool edid_cache_use(struct hpd_data *data, const u8 *blob,
+			size_t len, u32 key)
 {
-	/*
-	 * Looks like HPD dropped and really did stay low.
-	 * Go ahead and reset the system.
-	 */
-	set_hpd_state(data, STATE_HPD_RESET, 0);
+	struct hpd_edid *edid = edid_cache_find(data, blob, key);
+
+	if (!edid || edid->len != len || memcmp(edid->blob, blob, len))
+		return false;
+
+	list_move(&edid->node, &data->edid_cache);
+	hpd_edid_set(data, edid);
+
+	return true;
 }
 
-static void edid_recheck_state(struct hpd_data *data)
+int hpd_edid_commit(struct hpd_data *data, struct hpd_edid *edid)
 {
-	int tgt_state, timeout, status;
+	struct hpd_edid *victim = NULL;
 
-	tgt_state = STATE_HPD_RESET;
-	timeout = 0;
-	
-	status = data->ops->edid_recheck(data->drv_data);
+	if (edid->len < HPD_EDID_BLOCK_LEN) {
+		hpd_edid_put(edid);
+		return -EINVAL;
+	}
 
-	if (status == -1) {
-		/*
-		 * Failed to read EDID. If we still have retry attempts left,
-		 * schedule another attempt. Otherwise give up and reset;
-		 */
-		data->edid_reads++;
-		if (data->edid_reads >= MAX_EDID_READ_ATTEMPTS) {
-			pr_info("hpd: EDID retry %d times. Giving up.\n",
-				data->edid_reads);
-		} else {
-			tgt_state = STATE_RECHECK_EDID;
-			timeout = CHECK_EDID_DELAY_MS;
-		}
-	} else if (status == 0) {
-		/*
-		 * Successful read and EDID is unchanged, just go back to
-		 * the DONE_ENABLED state and do nothing.
-		 */
-		pr_info("hpd: No EDID change, taking no action.\n");
-		tgt_state = STATE_DONE_ENABLED;
-		timeout = -1;
+	edid->key = edid_key(edid->blob);
+
+	hpd_lock(data);
+	if (edid_cache_use(data, edid->blob, edid->len, edid->key)) {
+		hpd_unlock(data);
+		hpd_edid_put(edid);
+		return 0;
 	}
 
-	set_hpd_state(data, tgt_state, timeout);
+	/* Same base block but different extensions replaces old entry */
+	victim = edid_cache_find(data, edid->blob, edid->key);
+	if (!victim && data->edid_cache_len >= HPD_EDID_CACHE_SIZE)
+		victim = list_last_entry(&data->edid_cache,
+					struct hpd_edid, node);
+	if (victim) {
+		list_del(&victim->node);
+		data->edid_cache_len--;
+	}
+	list_add(&edid->node, &data->edid_cache);
+	data->edid_cache_len++;
+	hpd_edid_set(data, edid);
+	hpd_unlock(data);
+
+	/* Readers may hold on to it, the cache just lets go */
+	hpd_edid_put(victim);
+
+	return 0;
 }
 
-typedef void (*dispatch_func_t)(struct hpd_data *data);
-static const dispatch_func_t state_machine_dispatch[] = {
-	hpd_reset_state,			/* STATE_HPD_RESET */
-	hpd_plug_state,				/* STATE_PLUG */
-	edid_check_state,			/* STATE_CHECK_EDID */
-	NULL,						/* STATE_DONE_DISABLED */
-	NULL,						/* STATE_DONE_ENABLED */
-	wait_for_hpd_reassert_state,/* STATE_WAIT_FOR_HPD_REASSERT */
-	edid_recheck_state,			/* STATE_RECHECK_EDID */
-	NULL,						/* STATE_INIT_FROM_BOOTLOADER */
-};
+int hpd_edid_store(struct hpd_data *data, const u8 *blob, size_t len)
+{
+	struct hpd_edid *edid;
+	bool cached;
 
-static void handle_hpd_evt(struct hpd_data *data, int cur_hpd)
+	if (!blob || len < HPD_EDID_BLOCK_LEN)
+		return -EINVAL;
+
+	hpd_lock(data);
+	cached = edid_cache_use(data, blob, len, edid_key(blob));
+	hpd_unlock(data);
+	if (cached)
+		return 0;
+
+	edid = hpd_edid_alloc(len);
+	if (!edid)
+		return -ENOMEM;
+	memcpy(edid->blob, blob, len);
+
+	return hpd_edid_commit(data, edid);
+}
+
+void hpd_get_state(struct hpd_data *data, struct hpd_status *status)
 {
-	int tgt_state;
-	int timeout = 0;
+	unsigned int seq;
 
-	if ((STATE_DONE_ENABLED == data->state) && !cur_hpd) {
-		/*
-		 * HPD dropped while we were in DONE_ENABLED. Hold
-		 * steady and wait to see if it comes back.
-		 */
-		tgt_state = STATE_WAIT_FOR_HPD_REASSERT;
-		timeout = HPD_DROP_TIMEOUT_MS;
-	} else if (STATE_WAIT_FOR_HPD_REASSERT == data->state &&
-		cur_hpd) {
-		/*
-		 * Looks like HPD dropped and eventually came back. Re-read the
-		 * EDID and reset the system only if the EDID has changed.
-		 */
-		data->edid_reads = 0;
-		tgt_state = STATE_RECHECK_EDID;
-		timeout = CHECK_EDID_DELAY_MS;
-	} else if (STATE_DONE_ENABLED == data->state && cur_hpd) {
-		/*
-		 * Looks like HPD dropped but came back quickly,
-		 * ignore it.
-		 */
-		pr_info("hpd: ignoring bouncing hpd\n");
-		return;
-	} else if (STATE_INIT_FROM_BOOTLOADER == data->state && cur_hpd) {
-		/*
-		 * We follow the same protocol as STATE_HPD_RESET
-		 * but avoid actually entering that state so
-		 * we do not actively disable HPD. Worker will check HPD
-		 * level again when it's woke up after 40ms.
-		 */
-		tgt_state = STATE_PLUG;
-		timeout = HPD_STABILIZE_MS;
-	} else {
-		/*
-		 * Looks like there was HPD activity while we were neither
-		 * waiting for it to go away during steady state output, nor
-		 * looking for it to come back after such an event. Wait until
-		 * HPD has been steady for at least 40 mSec, then restart the
-		 * state machine.
-		 */
-		tgt_state = STATE_HPD_RESET;
-		timeout = HPD_STABILIZE_MS;
+	do {
+		seq = raw_read_seqcount_latch(&data->status_seq);
+		*status = data->status[seq & 1];
+	} while (read_seqcount_latch_retry(&data->status_seq, seq));
+}
+
+bool hpd_is_enabled(struct hpd_data *data)
+{
+	struct hpd_status status;
+
+	hpd_get_state(data, &status);
+
+	/* Display is kept up while a drop is waited out and rechecked */
+	switch (status.state) {
+	case STATE_DONE_ENABLED:
+	case STATE_WAIT_FOR_HPD_REASSERT:
+	case STATE_RECHECK_EDID:
+		return true;
+	default:
+		return false;
 	}
+}
 
-	set_hpd_state(data, tgt_state, timeout);
+struct hpd_edid *hpd_edid_get(struct hpd_data *data)
+{
+	struct hpd_edid *edid;
+
+	rcu_read_lock();
+	edid = rcu_dereference(data->edid);
+	if (edid && !kref_get_unless_zero(&edid->ref))
+		edid = NULL;
+	rcu_read_unlock();
+
+	return edid;
 }
 
-static void hpd_worker(struct work_struct *work)
+int hpd_quirk_add(const struct hpd_quirk *quirk)
 {
-	int pending_hpd_evt, cur_hpd;
-	struct hpd_data *data = container_of(
-					to_delayed_work(work),
-					struct hpd_data, dwork);
+	struct hpd_quirk_entry *entry, *old;
+	struct hpd_retry_policy *retry;
 
-	/*
-	 * Observe and clear pending flag
-	 * and latch the current HPD state.
-	 */
-	mutex_lock(&data->lock);
-	pending_hpd_evt = data->pending_hpd_evt;
-	data->pending_hpd_evt = 0;
-	mutex_unlock(&data->lock);
-	cur_hpd = data->ops->get_hpd_state(data->drv_data);
+	entry = kzalloc(sizeof(*entry), GFP_KERNEL);
+	if (!entry)
+		return -ENOMEM;
 
-	pr_info("hpd: state %d (%s), hpd %d, pending_hpd_evt %d\n",
-		data->state, state_names[data->state],
-		cur_hpd, pending_hpd_evt);
+	entry->quirk = *quirk;
+	retry = &entry->quirk.edid_retry;
+	if (retry->initial_delay_ms || retry->multiplier_pct ||
+		retry->max_delay_ms || retry->max_attempts)
+		hpd_retry_init(retry);
 
-	if (pending_hpd_evt) {
-		/*
-		 * If we were woken up because of HPD activity, just schedule
-		 * the next appropriate task and get out.
-		 */
-		handle_hpd_evt(data, cur_hpd);
-	} else if (data->state < ARRAY_SIZE(state_machine_dispatch)) {
-		dispatch_func_t func = state_machine_dispatch[data->state];
+	mutex_lock(&hpd_quirks_lock);
+	old = hpd_quirk_find(quirk->vendor, quirk->product);
+	if (old)
+		list_replace(&old->node, &entry->node);
+	else
+		list_add_tail(&entry->node, &hpd_quirks);
+	mutex_unlock(&hpd_quirks_lock);
 
-		if (NULL == func)
-			pr_warn("hpd: NULL state handler in state %d\n",
-				data->state);
-		else
-			func(data);
-	} else {
-		pr_warn("hpd: unexpected state scheduled %d",
-			data->state);
+	kfree(old);
+
+	return 0;
+}
+
+int hpd_bind_ops(struct hpd_ops *ops)
+{
+	int ret = 0;
+
+	mutex_lock(&hpd_bind_lock);
+	if (hpd_bound_ops) {
+		if (hpd_bound_ops != ops)
+			ret = -EBUSY;
+		goto out;
 	}
+
+	static_call_update(hpd_get_hpd_state, ops->get_hpd_state);
+	static_call_update(hpd_disable, ops->disable);
+	static_call_update(hpd_edid_read, ops->edid_read);
+	static_call_update(hpd_edid_read_start, ops->edid_read_start);
+	static_call_update(hpd_edid_read_base, ops->edid_read_base);
+	static_call_update(hpd_edid_ready, ops->edid_ready);
+	static_call_update(hpd_edid_recheck, ops->edid_recheck);
+	static_call_update(hpd_sink_id, ops->sink_id);
+
+	WRITE_ONCE(hpd_bound_ops, ops);
+	static_branch_enable(&hpd_ops_bound);
+out:
+	mutex_unlock(&hpd_bind_lock);
+
+	return ret;
 }
 
-static void sched_hpd_work(struct hpd_data *data, int resched_time)
+/* Called with hpd_bind_lock held */
+static void __hpd_unbind_ops(void)
 {
-	cancel_delayed_work(&data->dwork);
+	/* Waits for the branch to be patched out on all cpus */
+	static_branch_disable(&hpd_ops_bound);
+	WRITE_ONCE(hpd_bound_ops, NULL);
 
-	if (resched_time >= 0 && !data->shutdown)
-		schedule_delayed_work(&data->dwork,
-				msecs_to_jiffies(resched_time));
+	static_call_update(hpd_get_hpd_state, NULL);
+	static_call_update(hpd_disable, NULL);
+	static_call_update(hpd_edid_read, NULL);
+	static_call_update(hpd_edid_read_start, NULL);
+	static_call_update(hpd_edid_read_base, NULL);
+	static_call_update(hpd_edid_ready, NULL);
+	static_call_update(hpd_edid_recheck, NULL);
+	static_call_update(hpd_sink_id, NULL);
 }
 
-static void set_hpd_state(struct hpd_data *data,
-			int target_state, int resched_time)
+void hpd_unbind_ops(struct hpd_ops *ops)
 {
-	mutex_lock(&data->lock);
+	mutex_lock(&hpd_bind_lock);
+	if (hpd_bound_ops == ops)
+		__hpd_unbind_ops();
+	mutex_unlock(&hpd_bind_lock);
+}
 
-	pr_info("hpd: switching from state %d (%s) to state %d (%s)\n",
-		data->state, state_names[data->state],
-		target_state, state_names[target_state]);
-	data->state = target_state;
+/*
+ * Unbind the ops of @data once no instance uses them anymore, they may
+ * go away with the client. @data is off hpd_instances already.
+ */
+static void hpd_unbind_unused_ops(struct hpd_data *data)
+{
+	struct hpd_data *other;
+	bool used = false;
 
-	/*
-	 * If the pending_hpd_evt flag is already set, don't bother to
-	 * reschedule the state machine worker.  We should be able to assert
-	 * that there is a worker callback already scheduled, and that it is
-	 * scheduled to run immediately. This is particularly important when
-	 * making the transition to the steady state ENABLED or DISABLED states.
-	 * If an HPD event occurs while the worker is in flight, after the
-	 * worker checks the state of the pending HPD flag, and then the state
-	 * machine transitions to ENABLE or DISABLED, the system would end up
-	 * canceling the callback to handle the HPD event were it not for this
-	 * check.
-	 */
-	if (!data->pending_hpd_evt)
-		sched_hpd_work(data, resched_time);
+	if (READ_ONCE(hpd_bound_ops) != data->ops)
+		return;
 
-	mutex_unlock(&data->lock);
+	mutex_lock(&hpd_bind_lock);
+	mutex_lock(&hpd_instances_lock);
+	list_for_each_entry(other, &hpd_instances, instance_node)
+		if (other->ops == data->ops)
+			used = true;
+	mutex_unlock(&hpd_instances_lock);
+
+	if (!used && hpd_bound_ops == data->ops)
+		__hpd_unbind_ops();
+	mutex_unlock(&hpd_bind_lock);
 }
 
-void hpd_shutdown(struct hpd_data *data)
+static void hpd_timing_init(struct hpd_timing *timing)
 {
-	data->shutdown = 1;
-	cancel_delayed_work_sync(&data->dwork);
-	
-	if (data->ops->shutdown)
-		data->ops->shutdown(data->drv_data);
+	if (!timing->stabilize_ms)
+		timing->stabilize_ms = HPD_STABILIZE_MS;
+	if (!timing->drop_timeout_ms)
+		timing->drop_timeout_ms = HPD_DROP_TIMEOUT_MS;
+	if (!timing->check_plug_delay_ms)
+		timing->check_plug_delay_ms = CHECK_PLUG_STATE_DELAY_MS;
+	if (!timing->edid_timeout_ms)
+		timing->edid_timeout_ms = CHECK_EDID_DELAY_MS;
+	if (!timing->stage_timeout_ms)
+		timing->stage_timeout_ms = HPD_STAGE_TIMEOUT_MS;
+	if (!timing->drop_margin_ms)
+		timing->drop_margin_ms = HPD_DROP_MARGIN_MS;
+
+	hpd_retry_init(&timing->edid_retry);
 }
 
-void hpd_set_pending_evt(struct hpd_data *data)
+int hpd_controller_init(struct hpd_controller *ctrl, const char *name)
 {
-	mutex_lock(&data->lock);
+	ctrl->wq = alloc_workqueue("hpd-%s",
+				WQ_HIGHPRI | WQ_UNBOUND | WQ_MEM_RECLAIM,
+				ctrl->max_workers, name);
+	if (!ctrl->wq)
+		return -ENOMEM;
 
-	/* We always schedule work any time there is a pending HPD event */
-	data->pending_hpd_evt = 1;
-	sched_hpd_work(data, 0);
+	mutex_init(&ctrl->lock);
+	INIT_LIST_HEAD(&ctrl->connectors);
+	hpd_bus_init(&ctrl->bus, -1);
 
-	mutex_unlock(&data->lock);
+	return 0;
+}
+
+void hpd_controller_destroy(struct hpd_controller *ctrl)
+{
+	WARN_ON(!list_empty(&ctrl->connectors));
+
+	destroy_workqueue(ctrl->wq);
+	ctrl->wq = NULL;
+	mutex_destroy(&ctrl->lock);
 }
 
 void hpd_init(struct hpd_data *data, void *drv_data, struct hpd_ops *ops)
 {
 	BUG_ON(!data || !ops ||
 		!ops->get_hpd_state ||
-		!ops->edid_read ||
+		(!ops->edid_read && !ops->edid_read_start) ||
 		!ops->edid_ready ||
-		!ops->edid_recheck);
+		(!ops->edid_recheck && !ops->edid_read_base));
 
 	if (ops->init)
 		ops->init(drv_data);
 
 	data->drv_data = drv_data;
 	data->state = STATE_INIT_FROM_BOOTLOADER;
-	data->pending_hpd_evt = 0;
+	data->state_ran = false;
+	/* Unknown, bootloader may have left it running */
+	data->display_on = true;
+	data->powered = false;
+	atomic_set(&data->pending_hpd_evt, 0);
+	atomic_set(&data->evt_gen, 0);
+	data->work_gen = 0;
+	atomic_set(&data->hpd_level, -1);
+	atomic64_set(&data->hpd_edge_ns, 0);
+	atomic_set(&data->evt_head, 0);
+	data->evt_seen = 0;
 	data->shutdown = 0;
+	data->suspended = 0;
 	data->ops = ops;
 	data->edid_reads = 0;
+	data->edid_async = EDID_ASYNC_IDLE;
+	data->edid_prefetch = EDID_ASYNC_IDLE;
+	data->stage = EDID_ASYNC_IDLE;
+	RCU_INIT_POINTER(data->edid, NULL);
+	INIT_LIST_HEAD(&data->edid_cache);
+	data->edid_cache_len = 0;
+
+	hpd_timing_init(&data->timing);
+
+	if (!data->name[0])
+		snprintf(data->name, sizeof(data->name), "hpd%d",
+			atomic_inc_return(&hpd_instance_count) - 1);
+	data->stats.state_enter_ns[data->state] = ktime_get_ns();
 
 	mutex_init(&data->lock);
+	seqcount_latch_init(&data->status_seq);
+	data->status[0].state = data->state;
+	data->status[0].gen = 0;
+	data->status[0].edid_key = 0;
+	data->status[1] = data->status[0];
+
+	INIT_LIST_HEAD(&data->bus_node);
+	data->bus = NULL;
+	if (ops->ddc_bus) {
+		int id = ops->ddc_bus(drv_data);
+
+		if (id >= 0) {
+			data->bus = hpd_bus_get(id);
+			if (!data->bus)
+				pr_warn("hpd: no memory for ddc bus %d\n", id);
+		}
+	}
+
+	if (data->ctrl) {
+		if (!data->wq)
+			data->wq = data->ctrl->wq;
+		if (data->ctrl->serialize_edid && !ops->ddc_bus)
+			data->bus = &data->ctrl->bus;
+
+		mutex_lock(&data->ctrl->lock);
+		list_add_tail(&data->ctrl_node, &data->ctrl->connectors);
+		mutex_unlock(&data->ctrl->lock);
+	}
+
+	if (!data->wq && (data->flags & HPD_FLAG_OWN_WQ)) {
+		/*
+		 * Keep hotplug latency independent of unrelated work
+		 * queued on system_wq.
+		 */
+		unsigned int wq_flags = WQ_HIGHPRI | WQ_MEM_RECLAIM;
+
+		/* Unbound work only honours the node of a cpu hint */
+		if (!(data->flags & HPD_FLAG_CPU) &&
+			((data->flags & HPD_FLAG_NUMA_NODE) || data->irq <= 0))
+			wq_flags |= WQ_UNBOUND;
+
+		data->wq = alloc_workqueue("hpd", wq_flags, 1);
+		if (data->wq)
+			data->own_wq = true;
+		else
+			pr_warn("hpd: failed to allocate workqueue\n");
+	}
+	if (!data->wq)
+		data->wq = system_wq;
 
 	INIT_DELAYED_WORK(&data->dwork, hpd_worker);
+
+	hpd_debugfs_init(data);
+	hpd_notify_add(data);
+
+	if (data->boot.enabled) {
+		const struct hpd_boot_handoff *boot = &data->boot;
+
+		if (boot->edid && hpd_edid_store(data, boot->edid,
+						boot->edid_len))
+			pr_warn("hpd: failed to store bootloader edid\n");
+
+		/* Don't wait for an hpd event to take over the display */
+		sched_hpd_work(data, 0);
+	}
 }
@@ -46,39 +46,106 @@ struct hpd_ops {
 	void (*disable)(void *drv_data);
 
 	/*
-	 * Client specific panel edid read. Implementation mandatory.
+	 * Client specific panel edid read. Implementation mandatory unless
+	 * edid_read_start is implemented.
 	 * Return true for edid read success, false for failure.
+	 * Client should hand the edid read to hpd_edid_commit() or
+	 * hpd_edid_store() so it can be cached, see edid_read_base.
 	 */
 	bool (*edid_read)(void *drv_data);
 
+	/*
+	 * Asynchronous alternative to edid_read. Start panel edid read and
+	 * return true if started. Client reports the outcome by calling
+	 * hpd_edid_read_done(). A read not reported within
+	 * hpd_timing.edid_timeout_ms counts as a failed attempt. Implementation
+	 * optional, used in place of edid_read when present.
+	 * Every started read must still be reported; until then the ddc bus
+	 * stays taken and no further read is started.
+	 * With HPD_FLAG_EDID_PREFETCH the read may be started while hpd is
+	 * still being debounced, so it must not be aborted by disable().
+	 */
+	bool (*edid_read_start)(void *drv_data);
+
+	/*
+	 * Read only the edid base block i.e. HPD_EDID_BLOCK_LEN bytes into
+	 * @buf. Return true on success. If the base block matches an edid
+	 * previously passed to hpd_edid_commit(), the full edid read is
+	 * skipped and edid_ready() is called straight away; client then
+	 * gets the cached edid with hpd_edid_get(). Implementation optional.
+	 */
+	bool (*edid_read_base)(void *drv_data, u8 *buf);
+
 	/*
 	 * New panel has been connected to the system and
 	 * edid is available. Tell others about it and enable
-	 * display sub-system. Implementation mandatory. */
+	 * display sub-system. Implementation mandatory.
+	 * Edid is available from hpd_edid_get() if it was stored. */
 	void (*edid_ready)(void *drv_data);
 
 	/*
-	 * Hpd dropped but came back again in < HPD_DROP_TIMEOUT_MS.
-	 * Checks for any edid change. Implementation mandatory.
+	 * Hpd dropped but came back again in < hpd_timing.drop_timeout_ms.
+	 * Checks for any edid change. Implementation mandatory unless
+	 * edid_read_base is implemented; the base block is then compared
+	 * against the stored edid instead, when there is one.
 	 * Return -1 for failure, 1 on edid change and 0 on same edid. 
 	 */
 	int (*edid_recheck)(void *drv_data);
-	
-	/* Release resources acquired during init. Implementation optional. */
-	void (*shutdown)(void *drv_data);
-};
 
-struct hpd_data {
-	struct delayed_work dwork;
-	int shutdown;
-	int state;
-	int pending_hpd_evt;
-	void *drv_data;
-	struct hpd_ops *ops;
+	/*
+	 * Returns a non zero hash identifying the connected sink e.g.
+	 * computed over the edid last read or compared by edid_recheck.
+	 * Used to remember how many edid read attempts each sink needs.
+	 * Implementation optional.
+	 */
+	u32 (*sink_id)(void *drv_data);
 
-	int edid_reads;
+	/*
+	 * Returns id of the ddc bus or other shared resource used for edid
+	 * access, or negative if not shared. Edid accesses of all hpd
+	 * instances on the same bus id are serialized, those on different
+	 * buses run in parallel. Implementation optional.
+	 */
+	int (*ddc_bus)(void *drv_data);
 
-	struct mutex lock;
+	/*
+	 * Power up ddc/aux clocks and the hpd sense block before the state
+	 * machine runs. Implementation optional.
+	 */
+	void (*active)(void *drv_data);
+
+	/*
+	 * State machine settled in a DONE state with nothing in flight,
+	 * hardware may be powered down until the next active() call. The
+	 * hpd interrupt must stay armed. Implementation optional.
+	 */
+	void (*idle)(void *drv_data);
+
+	/*
+	 * Start link training towards the sink after edid_ready(), and
+	 * return true if started. Client reports the outcome by calling
+	 * hpd_stage_done(). Failure or no report within
+	 * hpd_timing.stage_timeout_ms disables the display. Implementation
+	 * optional, LINK_TRAIN is skipped without it.
+	 */
+	bool (*link_train_start)(void *drv_data);
+
+	/*
+	 * Start the modeset after link training, same protocol as
+	 * link_train_start. Implementation optional, MODESET is skipped
+	 * without it.
+	 */
+	bool (*modeset_start)(void *drv_data);
+
+	/*
+	 * Abort link training or modeset in flight, because of an hpd event
+	 * or timeout. A later hpd_stage_done() for it is ignored. Must not
+	 * call hpd_stage_done(). Implementation optional.
+	 */
+	void (*stage_abort)(void *drv_data);
+
+	/* Release resources acquired during init. Implementation optional. */
+	void (*shutdown)(void *drv_data);
 };
 
 enum {
@@ -155,16 +222,397 @@ enum {
 	 */
 	STATE_INIT_FROM_BOOTLOADER,
 
+	/*
+	 * After edid_ready(), the link to the sink is trained and then the
+	 * mode set, each in its own state as an asynchronous client stage.
+	 * The worker stays free meanwhile, so an hpd event aborts a stage in
+	 * flight straight away. Success moves on to the next stage and
+	 * finally to DONE_ENABLED, failure or timeout to DONE_DISABLED. A
+	 * stage the client has no callback for is skipped.
+	 */
+	STATE_LINK_TRAIN,
+	STATE_MODESET,
+
 	/*
 	 * STATE_COUNT must be the final state in the enum.
 	 * 1) Do not add states after STATE_COUNT.
 	 * 2) Do not assign explicit values to the states.
-	 * 3) Do not reorder states in the list without reordering the dispatch
-	 *    table in hpd.c
+	 * 3) Every state needs an entry in the hpd_states transition table
+	 *    and in state_names in hpd.c
 	 */
 	HPD_STATE_COUNT,
 };
 
+#define HPD_NAME_LEN 16
+
+/*
+ * Latency distribution. Bucket 0 counts samples below 1ms, bucket i
+ * counts samples in [2^(i-1), 2^i) ms and the last bucket all the rest.
+ */
+#define HPD_LAT_BUCKETS 12
+
+struct hpd_latency {
+	u64 min_ns;
+	u64 max_ns;
+	u64 total_ns;
+	u32 count;
+	u32 hist[HPD_LAT_BUCKETS];
+};
+
+/*
+ * Per instance timing counters, exposed in debugfs as hpd/<name>/stats.
+ * Writing to hpd/<name>/stats_reset clears them.
+ */
+struct hpd_stats {
+	u64 state_enter_ns[HPD_STATE_COUNT];
+	u64 state_time_ns[HPD_STATE_COUNT];
+	u32 state_entries[HPD_STATE_COUNT];
+
+	/* first hpd event not yet settled in DONE state, 0 if none */
+	atomic64_t evt_ns;
+	struct hpd_latency evt_to_ready;
+	struct hpd_latency evt_to_disable;
+
+	u32 edid_retries;
+	u32 edid_failures;
+	u32 edid_cache_hits;
+	u32 edid_cache_misses;
+	u32 transitions_coalesced;
+	u32 disables_skipped;
+	u32 edid_prefetch_hits;
+	u32 edid_prefetch_discards;
+
+	/* client calls, to compare timing policies by */
+	u32 disable_calls;
+	u32 edid_ready_calls;
+	u32 ddc_reads;		/* edid accesses, cache checks included */
+
+	/* cost of hpd event storms */
+	atomic_t evts_raised;
+	atomic_t evts_merged;	/* raised while the last one was pending */
+	atomic_t work_mods;	/* mod_delayed_work() calls */
+	atomic_t work_cancels;
+	u32 worker_runs;
+	u64 worker_ns;
+	u64 worker_max_ns;
+	u32 lock_contended;	/* hpd_data.lock found taken */
+
+	/* HPD_FLAG_LEARN_DROP */
+	u32 drop_learned_waits;
+	u32 drop_mispredictions;
+
+	/* transitions and client calls dropped for a newer hpd event */
+	u32 stale_dropped;
+};
+
+/*
+ * Edid read retry policy. Delay before attempt n + 1 is
+ * initial_delay_ms * (multiplier_pct / 100)^n, capped to max_delay_ms.
+ */
+struct hpd_retry_policy {
+	u32 initial_delay_ms;
+	u32 multiplier_pct;
+	u32 max_delay_ms;
+	u32 max_attempts;
+};
+
+/*
+ * Per instance state machine timing. Fields left zero at hpd_init()
+ * get the defaults noted below.
+ *
+ * @stabilize_ms: hpd must be steady this long before the state machine
+ * restarts on an hpd event. Default 40.
+ * @drop_timeout_ms: how long hpd may stay low in WAIT_FOR_HPD_REASSERT
+ * before the sink is considered unplugged. Default 1500.
+ * @check_plug_delay_ms: delay from RESET to checking the plug state.
+ * Default 10.
+ * @edid_timeout_ms: timeout for hpd_ops.edid_read_start. Default 60.
+ * @min_pulse_us: in steady state, hpd pulses shorter than this that
+ * leave hpd at its settled level are ignored outright instead of
+ * restarting the state machine. Needs levels from hpd_report_evt().
+ * Default 0 i.e. disabled.
+ * @edid_retry: edid read retry policy for CHECK_EDID and RECHECK_EDID.
+ * Default 60ms constant delay, capped at 1000ms, and 5 attempts.
+ * @stage_timeout_ms: timeout for hpd_ops.link_train_start and
+ * modeset_start. Default 500.
+ * @drop_margin_ms: added to the longest drop seen of a sink, see
+ * HPD_FLAG_LEARN_DROP. Default 50.
+ */
+struct hpd_timing {
+	u32 stabilize_ms;
+	u32 drop_timeout_ms;
+	u32 check_plug_delay_ms;
+	u32 edid_timeout_ms;
+	u32 min_pulse_us;
+	struct hpd_retry_policy edid_retry;
+	u32 stage_timeout_ms;
+	u32 drop_margin_ms;
+};
+
+/*
+ * Timing quirk of a sink model, keyed by the edid manufacturer and
+ * product code. Applies to an instance while an edid of that model is
+ * the known edid. Zero fields keep the instance timing, an edid_retry
+ * with max_attempts set replaces the instance retry policy.
+ */
+struct hpd_quirk {
+	u16 vendor;		/* edid bytes 8-9, big endian */
+	u16 product;		/* edid bytes 10-11, little endian */
+	u32 stabilize_ms;
+	u32 drop_timeout_ms;
+	struct hpd_retry_policy edid_retry;
+};
+
+/*
+ * Display state left by bootloader, filled by client before hpd_init().
+ *
+ * @enabled: bootloader has display running on this interface. The state
+ * machine then takes over without waiting for an hpd event. If hpd is
+ * steady and asserted it goes straight to DONE_ENABLED, calling
+ * edid_ready() without an edid read; client is expected to keep the mode
+ * set by bootloader rather than do a full modeset. Edid is then verified
+ * in background with edid_recheck().
+ * @edid: edid used by bootloader, optional. Stored as if passed to
+ * hpd_edid_store().
+ */
+struct hpd_boot_handoff {
+	bool enabled;
+	const u8 *edid;
+	size_t edid_len;
+};
+
+/*
+ * Raw hpd edges, recorded locklessly on every hpd event in a per
+ * instance ring and dumped in debugfs as hpd/<name>/events.
+ */
+#define HPD_EVT_RING_SIZE 64	/* must be a power of two */
+
+struct hpd_edge {
+	u32 seq;	/* event sequence number, 0 while being written */
+	int level;	/* hpd level, -1 if not reported by client */
+	int state;	/* state machine state when the edge was seen */
+	u64 ts_ns;
+};
+
+/*
+ * Edid blob of a sink, kept in a per instance LRU cache. Reference
+ * counted and freed after an rcu grace period, so the edid of the
+ * connected sink, hpd_data.edid, can be read either under
+ * rcu_read_lock() or with a reference from hpd_edid_get(). An edid is
+ * never changed once committed, a new sink gets a new one.
+ */
+#define HPD_EDID_BLOCK_LEN 128
+#define HPD_EDID_CACHE_SIZE 4
+
+struct hpd_edid {
+	struct list_head node;
+	struct kref ref;
+	struct rcu_head rcu;
+	u32 key;	/* crc32 of the base block */
+	size_t len;
+	u8 blob[];
+};
+
+/*
+ * Edid read attempts last needed by a sink, see hpd_ops.sink_id, and the
+ * length of its last hpd drops that came back in WAIT_FOR_HPD_REASSERT
+ */
+#define HPD_SINK_HINTS 8
+#define HPD_DROP_SAMPLES 8
+
+struct hpd_sink_hint {
+	u32 sink_id;
+	u32 attempts;
+	u16 drop_ms[HPD_DROP_SAMPLES];
+	u8 drop_next;
+	u8 drop_count;
+};
+
+/*
+ * Arbitrates edid access among connectors sharing a ddc bus. Connectors
+ * finding the bus busy queue up without using up edid read attempts and
+ * are woken when it frees up.
+ */
+struct hpd_bus {
+	spinlock_t lock;
+	struct hpd_data *owner;
+	struct list_head waiters;
+
+	/* hpd_ops.ddc_bus id, -1 for a controller's bus */
+	int id;
+	int users;
+	struct list_head node;
+};
+
+/*
+ * Owner of many hpd instances e.g. all outputs of a video wall
+ * controller. Connectors share one bounded worker pool, get their timers
+ * batched so they wake up together, and may have edid access serialized.
+ *
+ * Client configuration, filled before hpd_controller_init():
+ * @max_workers: max connectors processed concurrently, 0 for default.
+ * @batch_ms: timer expiries are rounded up to a multiple of this, 0 to
+ * disable batching.
+ * @serialize_edid: all connectors share a single ddc bus, unless they
+ * declare one with hpd_ops.ddc_bus.
+ */
+struct hpd_controller {
+	int max_workers;
+	u32 batch_ms;
+	bool serialize_edid;
+
+	struct workqueue_struct *wq;
+	struct mutex lock;
+	struct list_head connectors;
+	struct hpd_bus bus;
+};
+
+/* Snapshot of an hpd instance, see hpd_get_state() */
+struct hpd_status {
+	int state;
+	u32 gen;	/* bumped on every state or edid change */
+	u32 edid_key;	/* hpd_edid.key of the known edid, 0 if none */
+};
+
+/* hpd_data.flags, set by client before hpd_init() */
+#define HPD_FLAG_OWN_WQ		(1 << 0)	/* allocate a workqueue */
+/*
+ * Start edid_read_start() as soon as hpd goes high instead of after the
+ * stabilize delay. The result is used only if hpd is still high when the
+ * PLUG state runs, it is dropped otherwise.
+ */
+#define HPD_FLAG_EDID_PREFETCH	(1 << 1)
+/*
+ * Wait in WAIT_FOR_HPD_REASSERT only as long as the sink's drops have
+ * been seen to last, plus hpd_timing.drop_margin_ms, once there are a few
+ * of them. Still capped at drop_timeout_ms. A sink coming back after the
+ * shortened wait gives up the display once, and its drop is learned.
+ */
+#define HPD_FLAG_LEARN_DROP	(1 << 2)
+/*
+ * Queue the worker on hpd_data.cpu, or near hpd_data.numa_node. On an
+ * unbound workqueue, such as a controller's, a cpu only selects its node.
+ */
+#define HPD_FLAG_CPU		(1 << 3)
+#define HPD_FLAG_NUMA_NODE	(1 << 4)
+
+struct hpd_data {
+	struct delayed_work dwork;
+	int shutdown;
+	int suspended;
+	int state;
+	bool state_ran;		/* handler of current state ran */
+	bool display_on;	/* disable() not called since edid_ready() */
+	atomic_t pending_hpd_evt;
+	/* bumped on every hpd event, latched by the worker in work_gen */
+	atomic_t evt_gen;
+	u32 work_gen;
+	/* level and time of last edge from hpd_report_evt(), -1 if polled */
+	atomic_t hpd_level;
+	atomic64_t hpd_edge_ns;
+	atomic_t evt_head;
+	u32 evt_seen;
+	struct hpd_edge evt_ring[HPD_EVT_RING_SIZE];
+	void *drv_data;
+	struct hpd_ops *ops;
+
+	int edid_reads;
+	int edid_step;
+	int edid_async;
+	int edid_prefetch;
+	int stage;
+	bool edid_verify;
+
+	/* edid of connected sink, NULL if unknown */
+	struct hpd_edid __rcu *edid;
+	/* quirk matching @edid, zero if none */
+	struct hpd_quirk quirk;
+	struct list_head edid_cache;
+	int edid_cache_len;
+
+	u32 sink_id;
+	int sink_hint_next;
+	/* drop in progress or found too short, see HPD_FLAG_LEARN_DROP */
+	u64 drop_ns;
+	u32 drop_sink;
+	u32 drop_len_ms;
+	bool drop_learned;
+	struct hpd_sink_hint sink_hints[HPD_SINK_HINTS];
+
+	struct mutex lock;
+	/*
+	 * Published under lock for hpd_get_state(). Latched, a reader uses
+	 * the copy not being written, so it never waits for the writer.
+	 */
+	seqcount_latch_t status_seq;
+	struct hpd_status status[2];
+
+	/*
+	 * Client configuration, filled before hpd_init(). Zero selects
+	 * default behavior.
+	 *
+	 * @wq: workqueue to run the state machine on. If NULL, hpd_init()
+	 * allocates a dedicated WQ_HIGHPRI | WQ_UNBOUND workqueue when
+	 * HPD_FLAG_OWN_WQ is set, else system_wq is used.
+	 * @name: instance name used for debugfs, "hpd<n>" if left empty.
+	 * @timing: state machine delays, see struct hpd_timing. Tunable at
+	 * runtime in debugfs under hpd/<name>/timing/.
+	 * @boot: bootloader handoff, see struct hpd_boot_handoff.
+	 * @ctrl: controller to attach this connector to. Its worker pool is
+	 * used unless @wq is set.
+	 * @pm_dev: device to hold a runtime pm reference on while the state
+	 * machine is active, next to hpd_ops.active/idle. Put with autosuspend
+	 * once settled.
+	 * @cpu: cpu to queue the worker on, with HPD_FLAG_CPU. With
+	 * HPD_FLAG_OWN_WQ the workqueue is then allocated per cpu, else
+	 * the hint is only as precise as @wq allows.
+	 * @numa_node: node to queue the worker on an online cpu of, with
+	 * HPD_FLAG_NUMA_NODE. Ignored if HPD_FLAG_CPU is set.
+	 * @irq: hpd interrupt of the client. Without a cpu or node hint the
+	 * worker follows its effective affinity, so that get_hpd_state() and
+	 * edid reads stay local to the device, as with HPD_FLAG_CPU. Unset
+	 * if <= 0.
+	 * A hinted cpu that is offline falls back to any cpu.
+	 */
+	unsigned int flags;
+	struct workqueue_struct *wq;
+	char name[HPD_NAME_LEN];
+	struct hpd_timing timing;
+	struct hpd_boot_handoff boot;
+	struct hpd_controller *ctrl;
+	struct device *pm_dev;
+	int cpu;
+	int numa_node;
+	int irq;
+
+	bool own_wq;
+	bool powered;		/* active() called, idle() not yet */
+	struct list_head ctrl_node;
+	struct hpd_bus *bus;
+	struct list_head bus_node;
+
+	struct hpd_stats stats;
+	struct dentry *debugfs;
+	struct hpd_replay *replay;
+
+	/* last connection state published on /dev/hpd, -1 if none */
+	int notify_connected;
+	struct list_head instance_node;
+};
+
+/*
+ * All hpd instances are listed by the /dev/hpd misc device, one line per
+ * instance after a change sequence line:
+ *
+ *	seq <n>
+ *	<name> <connected> <state>
+ *
+ * poll() on it signals readable once the sequence moved past the one last
+ * read. Connection changes are batched over notify_batch_ms, so that a
+ * re-plug of many outputs wakes up userspace once. Seek to 0 before each
+ * read.
+ */
+
 /*
  * initialize hpd workhorse
  * 
@@ -174,13 +622,183 @@ enum {
  *
  * Here client is the driver using services of the hpd state machine.
  * Most likely a display interface driver e.g. hdmi, displayport
+ *
+ * @data is expected to be zero initialized, apart from the client
+ * configuration fields documented in struct hpd_data.
  */
 void hpd_init(struct hpd_data *data, void *drv_data, struct hpd_ops *ops);
 
+/*
+ * bind an ops table for direct calls
+ *
+ * @ops: ops table, must stay unchanged until the module is unloaded
+ *
+ * Instances initialized with @ops call get_hpd_state(), disable(),
+ * edid_*() and sink_id() through static calls instead of indirect calls.
+ * Meant for a client with a fixed implementation, called once before
+ * or after its hpd_init(). Other instances keep calling through their
+ * ops. Only one table can be bound, returns 0 on success or -EBUSY if
+ * another one is bound already. The table is unbound again by
+ * hpd_unbind_ops() or when the last instance using it is shut down.
+ */
+int hpd_bind_ops(struct hpd_ops *ops);
+
+/*
+ * unbind an ops table bound by hpd_bind_ops(), if it still is
+ *
+ * Instances using @ops must be shut down by then. Call before @ops goes
+ * away if it was bound without any instance using it.
+ */
+void hpd_unbind_ops(struct hpd_ops *ops);
+
 /* release all resources acquired during hpd_init */
 void hpd_shutdown(struct hpd_data *data);
 
-/* raise a request to process hotplug event i.e. plug or unplug */
+/*
+ * stop the state machine for system suspend, keeping its state
+ *
+ * Hpd events raised while suspended are only acted upon by hpd_resume().
+ * An edid read started by edid_read_start() must still be reported, its
+ * result is dropped and the ddc bus stays taken until then.
+ */
+void hpd_suspend(struct hpd_data *data);
+
+/*
+ * restart the state machine after system resume
+ *
+ * If a sink was enabled before suspend and hpd is still asserted, only
+ * the edid is checked in the background, preferably just its base block
+ * against the cached edid, and display stays up when unchanged. Anything
+ * else is handled as a regular hotplug event.
+ */
+void hpd_resume(struct hpd_data *data);
+
+/*
+ * raise a request to process hotplug event i.e. plug or unplug
+ *
+ * Lockless and safe to call from any context, including client's hard
+ * irq handler.
+ */
 void hpd_set_pending_evt(struct hpd_data *data);
 
+/*
+ * raise a hotplug event along with the hpd level it left behind
+ *
+ * @level: hpd level after the edge, true if asserted
+ * @timestamp: time of the edge, e.g. ktime_get() in client's irq handler
+ *
+ * Same as hpd_set_pending_evt(), but the state machine uses @level
+ * instead of polling hpd_ops.get_hpd_state, and debounce periods are
+ * measured from @timestamp. Client is expected to report every edge
+ * this way; a later hpd_set_pending_evt() reverts to polling.
+ */
+void hpd_report_evt(struct hpd_data *data, bool level, ktime_t timestamp);
+
+/*
+ * report completion of edid read started by hpd_ops.edid_read_start
+ *
+ * @ok: true if edid was read successfully
+ *
+ * Must be called from process context.
+ */
+void hpd_edid_read_done(struct hpd_data *data, bool ok);
+
+/*
+ * report completion of hpd_ops.link_train_start or modeset_start
+ *
+ * @ok: true if the stage succeeded
+ *
+ * Must be called from process context.
+ */
+void hpd_stage_done(struct hpd_data *data, bool ok);
+
+/*
+ * allocate an edid buffer for the client to read an edid into
+ *
+ * @len: edid length in bytes
+ *
+ * Client fills hpd_edid.blob in place and hands it to hpd_edid_commit(),
+ * or drops it with hpd_edid_put(). Returns NULL if out of memory.
+ */
+struct hpd_edid *hpd_edid_alloc(size_t len);
+
+/*
+ * make an edid read into a buffer from hpd_edid_alloc() the edid of the
+ * connected sink, and cache it
+ *
+ * Takes over the caller's reference, also on error. If the same edid is
+ * cached already, the cached one is used and @edid released. Readers see
+ * the connected sink's edid switch atomically. Returns 0 on success or
+ * negative error code.
+ */
+int hpd_edid_commit(struct hpd_data *data, struct hpd_edid *edid);
+
+/*
+ * store edid of connected sink in hpd edid cache
+ *
+ * @edid: full edid blob, at least HPD_EDID_BLOCK_LEN bytes
+ * @len: edid length in bytes
+ *
+ * Same as hpd_edid_commit(), for an edid read into a client buffer.
+ * Copies only if the edid isn't cached yet.
+ */
+int hpd_edid_store(struct hpd_data *data, const u8 *edid, size_t len);
+
+/*
+ * get edid of connected sink, NULL if none is known
+ *
+ * Returns an edid reference to drop with hpd_edid_put(). Readers that
+ * don't sleep can do without, dereferencing hpd_data.edid with
+ * rcu_dereference() under rcu_read_lock() instead.
+ */
+struct hpd_edid *hpd_edid_get(struct hpd_data *data);
+
+void hpd_edid_put(struct hpd_edid *edid);
+
+/*
+ * get state machine state, generation and edid key without locking
+ *
+ * Cheap enough for hot paths of audio, hdcp or cec drivers polling the
+ * connector. Safe from any context, nmi included. A changed
+ * hpd_status.gen tells the state or edid changed in between two calls.
+ */
+void hpd_get_state(struct hpd_data *data, struct hpd_status *status);
+
+/*
+ * true if the sink is connected and enabled i.e. STATE_DONE_ENABLED, or
+ * hpd dropped from there and is being waited out or the edid rechecked,
+ * in WAIT_FOR_HPD_REASSERT or RECHECK_EDID. Display stays up meanwhile
+ * and /dev/hpd keeps reporting the sink connected.
+ */
+bool hpd_is_enabled(struct hpd_data *data);
+
+/*
+ * add a sink timing quirk, replacing one for the same model
+ *
+ * Takes effect on instances the next time an edid of the model becomes
+ * known. Quirks can also be listed and added at runtime in debugfs
+ * hpd/quirks, one per line as
+ *
+ *	<vendor> <product> <stabilize_ms> <drop_timeout_ms>
+ *		[<initial_delay_ms> <multiplier_pct> <max_delay_ms>
+ *		<max_attempts>]
+ *
+ * with vendor and product in hex. Writing "clear" removes all quirks.
+ */
+int hpd_quirk_add(const struct hpd_quirk *quirk);
+
+/*
+ * initialize controller for many hpd instances
+ *
+ * @ctrl: controller, configuration fields filled in by client
+ * @name: controller name
+ *
+ * Returns 0 on success or negative error code. Connectors are attached
+ * by setting hpd_data.ctrl before hpd_init().
+ */
+int hpd_controller_init(struct hpd_controller *ctrl, const char *name);
+
+/* release controller resources, all connectors must be shut down */
+void hpd_controller_destroy(struct hpd_controller *ctrl);
+
 #endif
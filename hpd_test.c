@@ -0,0 +1,305 @@
+/*
+ * HPD: KUnit tests of the hotplug detect state machine
+ *
+ * Author: Animesh Kishore <animesh.kishore@gmail.com>
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 3, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <kunit/test.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/delay.h>
+#include <linux/jiffies.h>
+#include <linux/atomic.h>
+#include "hpd.h"
+
+#define HPD_TEST_THREADS	4
+#define HPD_TEST_EVTS		10000	/* per thread */
+#define HPD_TEST_SETTLE_MS	5000
+
+/*
+ * Fake client. Hpd level is whatever the test set, edid reads always
+ * succeed and the display is only tracked as on or off.
+ */
+struct hpd_test_client {
+	struct hpd_data data;
+	bool level;
+	bool display_on;
+	atomic_t edid_reads;
+	atomic_t edid_ready_calls;
+	atomic_t disable_calls;
+};
+
+struct hpd_test_storm {
+	struct hpd_test_client *client;
+	int evts;
+	bool toggle;	/* flip hpd level before every event */
+	struct completion done;
+};
+
+static bool hpd_test_get_hpd_state(void *drv_data)
+{
+	struct hpd_test_client *client = drv_data;
+
+	return READ_ONCE(client->level);
+}
+
+static void hpd_test_disable(void *drv_data)
+{
+	struct hpd_test_client *client = drv_data;
+
+	WRITE_ONCE(client->display_on, false);
+	atomic_inc(&client->disable_calls);
+}
+
+static bool hpd_test_edid_read(void *drv_data)
+{
+	struct hpd_test_client *client = drv_data;
+
+	atomic_inc(&client->edid_reads);
+	return true;
+}
+
+static void hpd_test_edid_ready(void *drv_data)
+{
+	struct hpd_test_client *client = drv_data;
+
+	WRITE_ONCE(client->display_on, true);
+	atomic_inc(&client->edid_ready_calls);
+}
+
+static int hpd_test_edid_recheck(void *drv_data)
+{
+	return 0;
+}
+
+static struct hpd_ops hpd_test_ops = {
+	.get_hpd_state = hpd_test_get_hpd_state,
+	.disable = hpd_test_disable,
+	.edid_read = hpd_test_edid_read,
+	.edid_ready = hpd_test_edid_ready,
+	.edid_recheck = hpd_test_edid_recheck,
+};
+
+static int hpd_test_init(struct kunit *test)
+{
+	struct hpd_test_client *client;
+
+	client = kunit_kzalloc(test, sizeof(*client), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, client);
+
+	snprintf(client->data.name, sizeof(client->data.name), "hpd_test");
+	client->data.flags = HPD_FLAG_OWN_WQ;
+	/* Short enough for the suite to settle fast, same state graph */
+	client->data.timing.stabilize_ms = 5;
+	client->data.timing.drop_timeout_ms = 20;
+	client->data.timing.check_plug_delay_ms = 1;
+	client->data.timing.edid_retry.initial_delay_ms = 1;
+	/* Nothing connected until a test says so */
+	client->display_on = false;
+	atomic_set(&client->edid_reads, 0);
+	atomic_set(&client->edid_ready_calls, 0);
+	atomic_set(&client->disable_calls, 0);
+
+	hpd_init(&client->data, client, &hpd_test_ops);
+	test->priv = client;
+
+	return 0;
+}
+
+static void hpd_test_exit(struct kunit *test)
+{
+	struct hpd_test_client *client = test->priv;
+
+	hpd_shutdown(&client->data);
+}
+
+/* Wait till the state machine is done and has no work left */
+static bool hpd_test_settle(struct hpd_test_client *client, int state)
+{
+	unsigned long timeout = jiffies + msecs_to_jiffies(HPD_TEST_SETTLE_MS);
+	struct hpd_data *data = &client->data;
+	struct hpd_status status;
+
+	do {
+		msleep(20);
+		hpd_get_state(data, &status);
+		if (status.state == state &&
+			!atomic_read(&data->pending_hpd_evt) &&
+			!delayed_work_pending(&data->dwork))
+			return true;
+	} while (time_before(jiffies, timeout));
+
+	return false;
+}
+
+static int hpd_test_storm_fn(void *arg)
+{
+	struct hpd_test_storm *storm = arg;
+	struct hpd_test_client *client = storm->client;
+	int i;
+
+	for (i = 0; i < storm->evts; i++) {
+		if (storm->toggle)
+			WRITE_ONCE(client->level, !READ_ONCE(client->level));
+		hpd_set_pending_evt(&client->data);
+		if (!(i % 64))
+			cond_resched();
+	}
+
+	complete(&storm->done);
+	return 0;
+}
+
+/*
+ * Raise HPD_TEST_EVTS events from each of HPD_TEST_THREADS kthreads at
+ * once, @togglers of them flipping the hpd level as they go. Leaves hpd
+ * at @level once all of them are done.
+ */
+static void hpd_test_storm(struct kunit *test, int togglers, bool level)
+{
+	struct hpd_test_client *client = test->priv;
+	struct hpd_data *data = &client->data;
+	struct hpd_stats *stats = &data->stats;
+	struct hpd_test_storm *storm;
+	struct task_struct *task;
+	int raised, merged, sent = 0;
+	u32 runs;
+	int i;
+
+	storm = kunit_kcalloc(test, HPD_TEST_THREADS, sizeof(*storm),
+			GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, storm);
+
+	WRITE_ONCE(client->level, true);
+	for (i = 0; i < HPD_TEST_THREADS; i++) {
+		storm[i].client = client;
+		storm[i].evts = HPD_TEST_EVTS;
+		storm[i].toggle = i < togglers;
+		init_completion(&storm[i].done);
+
+		task = kthread_run(hpd_test_storm_fn, &storm[i],
+				"hpd_test/%d", i);
+		KUNIT_ASSERT_FALSE(test, IS_ERR(task));
+		sent += storm[i].evts;
+	}
+
+	for (i = 0; i < HPD_TEST_THREADS; i++)
+		wait_for_completion(&storm[i].done);
+
+	/* Last word on hpd, as a client would after its final edge */
+	WRITE_ONCE(client->level, level);
+	hpd_set_pending_evt(data);
+	sent++;
+
+	KUNIT_ASSERT_TRUE(test, hpd_test_settle(client,
+		level ? STATE_DONE_ENABLED : STATE_DONE_DISABLED));
+
+	raised = atomic_read(&stats->evts_raised);
+	merged = atomic_read(&stats->evts_merged);
+	runs = stats->worker_runs;
+
+	kunit_info(test,
+		"%d events, %d merged, %u worker runs (%u per 1000 events)\n",
+		raised, merged, runs, raised ? runs * 1000 / raised : 0);
+	kunit_info(test, "worker avg %llu max %llu ns, lock contended %u\n",
+		runs ? div_u64(stats->worker_ns, runs) : 0,
+		stats->worker_max_ns, stats->lock_contended);
+	kunit_info(test, "edid_ready %d disable %d\n",
+		atomic_read(&client->edid_ready_calls),
+		atomic_read(&client->disable_calls));
+
+	KUNIT_EXPECT_EQ(test, raised, sent);
+	KUNIT_EXPECT_LE(test, merged, raised);
+	/* Every event not merged queued or cancelled the worker */
+	KUNIT_EXPECT_GE(test, atomic_read(&stats->work_mods) +
+		atomic_read(&stats->work_cancels), raised - merged);
+	/* A storm must be coalesced, not run once per event */
+	KUNIT_EXPECT_LT(test, runs, (u32)raised);
+	/*
+	 * Raising an event is lock free, the worker is the only one to
+	 * take the instance lock here and it never runs concurrently.
+	 */
+	KUNIT_EXPECT_EQ(test, stats->lock_contended, 0u);
+
+	KUNIT_EXPECT_EQ(test, READ_ONCE(client->display_on), level);
+	KUNIT_EXPECT_EQ(test, hpd_is_enabled(data), level);
+}
+
+static void hpd_test_plug(struct kunit *test)
+{
+	struct hpd_test_client *client = test->priv;
+	struct hpd_data *data = &client->data;
+
+	WRITE_ONCE(client->level, true);
+	hpd_set_pending_evt(data);
+
+	KUNIT_ASSERT_TRUE(test, hpd_test_settle(client, STATE_DONE_ENABLED));
+	KUNIT_EXPECT_TRUE(test, READ_ONCE(client->display_on));
+	KUNIT_EXPECT_EQ(test, atomic_read(&client->edid_ready_calls), 1);
+	KUNIT_EXPECT_GE(test, atomic_read(&client->edid_reads), 1);
+	KUNIT_EXPECT_EQ(test, atomic_read(&data->stats.evts_raised), 1);
+	KUNIT_EXPECT_EQ(test, data->stats.lock_contended, 0u);
+}
+
+static void hpd_test_unplug(struct kunit *test)
+{
+	struct hpd_test_client *client = test->priv;
+	struct hpd_data *data = &client->data;
+
+	WRITE_ONCE(client->level, true);
+	hpd_set_pending_evt(data);
+	KUNIT_ASSERT_TRUE(test, hpd_test_settle(client, STATE_DONE_ENABLED));
+
+	WRITE_ONCE(client->level, false);
+	hpd_set_pending_evt(data);
+	KUNIT_ASSERT_TRUE(test, hpd_test_settle(client, STATE_DONE_DISABLED));
+
+	KUNIT_EXPECT_FALSE(test, READ_ONCE(client->display_on));
+	KUNIT_EXPECT_GE(test, atomic_read(&client->disable_calls), 1);
+}
+
+/* Events at a steady high level, nothing for the worker to change */
+static void hpd_test_storm_steady(struct kunit *test)
+{
+	hpd_test_storm(test, 0, true);
+}
+
+/* One thread bouncing hpd while the others keep raising events */
+static void hpd_test_storm_bounce(struct kunit *test)
+{
+	hpd_test_storm(test, 1, true);
+}
+
+/* Bouncing storm ending in an unplug */
+static void hpd_test_storm_unplug(struct kunit *test)
+{
+	hpd_test_storm(test, 1, false);
+}
+
+static struct kunit_case hpd_test_cases[] = {
+	KUNIT_CASE(hpd_test_plug),
+	KUNIT_CASE(hpd_test_unplug),
+	KUNIT_CASE_SLOW(hpd_test_storm_steady),
+	KUNIT_CASE_SLOW(hpd_test_storm_bounce),
+	KUNIT_CASE_SLOW(hpd_test_storm_unplug),
+	{}
+};
+
+static struct kunit_suite hpd_test_suite = {
+	.name = "hpd",
+	.init = hpd_test_init,
+	.exit = hpd_test_exit,
+	.test_cases = hpd_test_cases,
+};
+
+kunit_test_suite(hpd_test_suite);
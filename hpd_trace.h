@@ -0,0 +1,125 @@
+/*
+ * HPD: hotplug detect state machine tracepoints
+ *
+ * Author: Animesh Kishore <animesh.kishore@gmail.com>
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 3, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM hpd
+
+#if !defined(__DISPLAY_HPD_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __DISPLAY_HPD_TRACE_H__
+
+#include <linux/tracepoint.h>
+#include "hpd.h"
+
+#define show_hpd_state(state)					\
+	__print_symbolic(state,					\
+		{ STATE_HPD_RESET, "Reset" },			\
+		{ STATE_PLUG, "Check Plug" },			\
+		{ STATE_CHECK_EDID, "Check EDID" },		\
+		{ STATE_DONE_DISABLED, "Disabled" },		\
+		{ STATE_DONE_ENABLED, "Enabled" },		\
+		{ STATE_WAIT_FOR_HPD_REASSERT, "Wait for HPD reassert" }, \
+		{ STATE_RECHECK_EDID, "Recheck EDID" },		\
+		{ STATE_INIT_FROM_BOOTLOADER, "Takeover from bootloader" }, \
+		{ STATE_LINK_TRAIN, "Link training" },		\
+		{ STATE_MODESET, "Modeset" })
+
+TRACE_EVENT(hpd_worker,
+	TP_PROTO(struct hpd_data *data, int hpd, int pending_hpd_evt),
+	TP_ARGS(data, hpd, pending_hpd_evt),
+	TP_STRUCT__entry(
+		__array(char, name, HPD_NAME_LEN)
+		__field(int, state)
+		__field(int, hpd)
+		__field(int, pending_hpd_evt)
+	),
+	TP_fast_assign(
+		memcpy(__entry->name, data->name, HPD_NAME_LEN);
+		__entry->state = data->state;
+		__entry->hpd = hpd;
+		__entry->pending_hpd_evt = pending_hpd_evt;
+	),
+	TP_printk("%s: state %s hpd %d pending_hpd_evt %d",
+		__entry->name, show_hpd_state(__entry->state),
+		__entry->hpd, __entry->pending_hpd_evt)
+);
+
+TRACE_EVENT(hpd_state_switch,
+	TP_PROTO(struct hpd_data *data, int target_state, int resched_time),
+	TP_ARGS(data, target_state, resched_time),
+	TP_STRUCT__entry(
+		__array(char, name, HPD_NAME_LEN)
+		__field(int, state)
+		__field(int, target_state)
+		__field(int, resched_time)
+	),
+	TP_fast_assign(
+		memcpy(__entry->name, data->name, HPD_NAME_LEN);
+		__entry->state = data->state;
+		__entry->target_state = target_state;
+		__entry->resched_time = resched_time;
+	),
+	TP_printk("%s: %s -> %s in %d ms",
+		__entry->name, show_hpd_state(__entry->state),
+		show_hpd_state(__entry->target_state),
+		__entry->resched_time)
+);
+
+/* @status: edid_read() or edid_recheck() return value */
+TRACE_EVENT(hpd_edid_read,
+	TP_PROTO(struct hpd_data *data, int attempt, int status),
+	TP_ARGS(data, attempt, status),
+	TP_STRUCT__entry(
+		__array(char, name, HPD_NAME_LEN)
+		__field(int, state)
+		__field(int, attempt)
+		__field(int, status)
+	),
+	TP_fast_assign(
+		memcpy(__entry->name, data->name, HPD_NAME_LEN);
+		__entry->state = data->state;
+		__entry->attempt = attempt;
+		__entry->status = status;
+	),
+	TP_printk("%s: %s attempt %d status %d",
+		__entry->name, show_hpd_state(__entry->state),
+		__entry->attempt, __entry->status)
+);
+
+TRACE_EVENT(hpd_bounce_ignored,
+	TP_PROTO(struct hpd_data *data),
+	TP_ARGS(data),
+	TP_STRUCT__entry(
+		__array(char, name, HPD_NAME_LEN)
+		__field(int, state)
+	),
+	TP_fast_assign(
+		memcpy(__entry->name, data->name, HPD_NAME_LEN);
+		__entry->state = data->state;
+	),
+	TP_printk("%s: state %s", __entry->name,
+		show_hpd_state(__entry->state))
+);
+
+#endif /* __DISPLAY_HPD_TRACE_H__ */
+
+/*
+ * This part must be outside protection. Build hpd.c with this directory
+ * in the include path, e.g. CFLAGS_hpd.o := -I$(src)
+ */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE hpd_trace
+#include <trace/define_trace.h>
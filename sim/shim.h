@@ -0,0 +1,586 @@
+/*
+ * HPD: userspace shims for building hpd.c into the simulator
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 3, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Forced ahead of hpd.c, every <linux/...> header it includes resolves to
+ * an empty file generated by the Makefile. Everything runs on a single
+ * thread in virtual time: delayed work expires only when the simulator
+ * advances the clock, locks just catch recursion, atomics are plain.
+ */
+
+#ifndef __HPD_SIM_SHIM_H__
+#define __HPD_SIM_SHIM_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef s64 ktime_t;
+typedef unsigned short umode_t;
+typedef unsigned int gfp_t;
+typedef unsigned int __poll_t;
+
+#define GFP_KERNEL 0
+#define __user
+#define __rcu
+#define __init
+#define __exit
+#define __maybe_unused __attribute__((unused))
+#define fallthrough __attribute__((__fallthrough__))
+#define likely(x) (x)
+#define unlikely(x) (x)
+
+#define BIT(n) (1UL << (n))
+#define BITS_PER_TYPE(t) (sizeof(t) * 8)
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define BUILD_BUG_ON(x) _Static_assert(!(x), #x)
+#define static_assert(x, ...) _Static_assert(x, #x)
+#define container_of(p, t, m) ((t *)((char *)(p) - offsetof(t, m)))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b) ((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define max_t(t, a, b) ((t)(a) > (t)(b) ? (t)(a) : (t)(b))
+#define clamp_t(t, v, l, h) min_t(t, max_t(t, v, l), h)
+#define roundup(x, y) ((((x) + ((y) - 1)) / (y)) * (y))
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define struct_size(p, m, n) (sizeof(*(p)) + sizeof((p)->m[0]) * (n))
+#define U16_MAX 0xffff
+#define PAGE_SIZE 4096UL
+
+#define BUG_ON(x)	do { if (x) sim_bug(__FILE__, __LINE__); } while (0)
+#define WARN_ON(x)	({ bool __w = !!(x); if (__w) sim_warn(__LINE__); __w; })
+#define WARN_ON_ONCE(x)	WARN_ON(x)
+
+#define READ_ONCE(x) (x)
+#define WRITE_ONCE(x, v) ((x) = (v))
+#define smp_mb() do { } while (0)
+#define smp_wmb() do { } while (0)
+#define smp_rmb() do { } while (0)
+
+#define EINVAL 22
+#define ENOMEM 12
+#define EBUSY 16
+#define EFAULT 14
+#define E2BIG 7
+#define IS_ERR(p) ((unsigned long)(p) > (unsigned long)-4096)
+#define IS_ERR_OR_NULL(p) (!(p) || IS_ERR(p))
+#define PTR_ERR(p) ((long)(p))
+#define ERR_PTR(e) ((void *)(long)(e))
+
+void sim_bug(const char *file, int line);
+void sim_warn(int line);
+
+/* logging with virtual time stamps in ms, only with the simulator's -v */
+extern int sim_verbose;
+extern u64 sim_now_ns;
+#define printk(fmt, ...)						\
+	({								\
+		if (sim_verbose)					\
+			fprintf(stderr, "[%6llu] " fmt,			\
+				(unsigned long long)(sim_now_ns / 1000000), \
+				##__VA_ARGS__);				\
+		0;							\
+	})
+#define pr_info(...) printk(__VA_ARGS__)
+#define pr_warn(...) printk(__VA_ARGS__)
+#define pr_err(...) printk(__VA_ARGS__)
+#define pr_debug(...) printk(__VA_ARGS__)
+#define pr_warn_once(...) printk(__VA_ARGS__)
+#define pr_info_ratelimited(...) printk(__VA_ARGS__)
+
+static inline int scnprintf(char *buf, size_t n, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+#include <stdarg.h>
+static inline int scnprintf(char *buf, size_t n, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	if (!n)
+		return 0;
+	va_start(ap, fmt);
+	len = vsnprintf(buf, n, fmt, ap);
+	va_end(ap);
+
+	return len >= (int)n ? (int)n - 1 : len;
+}
+
+static inline char *skip_spaces(const char *s)
+{
+	while (*s == ' ' || *s == '\t' || *s == '\n')
+		s++;
+	return (char *)s;
+}
+
+static inline char *strim(char *s)
+{
+	size_t len = strlen(s);
+
+	while (len && (s[len - 1] == ' ' || s[len - 1] == '\n'))
+		s[--len] = 0;
+	return skip_spaces(s);
+}
+
+static inline bool sysfs_streq(const char *a, const char *b)
+{
+	while (*a && *a == *b)
+		a++, b++;
+	if (*a == '\n')
+		a++;
+	if (*b == '\n')
+		b++;
+	return !*a && !*b;
+}
+
+static inline int kstrtou32(const char *s, unsigned int base, u32 *res)
+{
+	char *end;
+
+	*res = strtoul(s, &end, base);
+	return end == s ? -EINVAL : 0;
+}
+
+static inline int kstrtoint(const char *s, unsigned int base, int *res)
+{
+	char *end;
+
+	*res = strtol(s, &end, base);
+	return end == s ? -EINVAL : 0;
+}
+
+#define kstrtouint(s, b, r) kstrtou32(s, b, r)
+
+static inline u64 div_u64(u64 n, u32 d)
+{
+	return n / d;
+}
+
+static inline s64 div_s64(s64 n, s32 d)
+{
+	return n / d;
+}
+
+#define fls(x) ((x) ? 32 - __builtin_clz(x) : 0)
+#define fls64(x) ((x) ? 64 - __builtin_clzll(x) : 0)
+
+/* memory */
+#define kmalloc(n, g) malloc(n)
+#define kzalloc(n, g) calloc(1, n)
+#define kcalloc(n, s, g) calloc(n, s)
+#define kfree(p) free((void *)(p))
+#define kfree_rcu(p, f) free(p)
+
+static inline void *kmemdup(const void *p, size_t n, gfp_t gfp)
+{
+	void *q = malloc(n);
+
+	if (q)
+		memcpy(q, p, n);
+	return q;
+}
+
+static inline void *memdup_user_nul(const void *p, size_t n)
+{
+	char *q = malloc(n + 1);
+
+	if (!q)
+		return ERR_PTR(-ENOMEM);
+	memcpy(q, p, n);
+	q[n] = 0;
+	return q;
+}
+
+static inline unsigned long copy_to_user(void *to, const void *from,
+					unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+static inline ssize_t simple_read_from_buffer(void *to, size_t count,
+		loff_t *ppos, const void *from, size_t available)
+{
+	loff_t pos = *ppos;
+
+	if (pos < 0)
+		return -EINVAL;
+	if (pos >= (loff_t)available || !count)
+		return 0;
+	if (count > available - pos)
+		count = available - pos;
+	memcpy(to, (const char *)from + pos, count);
+	*ppos = pos + count;
+	return count;
+}
+
+/* atomics, single threaded */
+typedef struct { int counter; } atomic_t;
+typedef struct { s64 counter; } atomic64_t;
+#define ATOMIC_INIT(i) { (i) }
+#define atomic_read(v) ((v)->counter)
+#define atomic_set(v, i) ((v)->counter = (i))
+#define atomic_inc(v) ((v)->counter++)
+#define atomic_dec(v) ((v)->counter--)
+#define atomic_inc_return(v) (++(v)->counter)
+#define atomic_dec_and_test(v) (--(v)->counter == 0)
+#define atomic_xchg(v, i) \
+	({ int __o = (v)->counter; (v)->counter = (i); __o; })
+#define atomic_cmpxchg(v, o, n) \
+	({ int __o = (v)->counter; if (__o == (o)) (v)->counter = (n); __o; })
+#define atomic64_read(v) ((v)->counter)
+#define atomic64_set(v, i) ((v)->counter = (i))
+#define atomic64_cmpxchg(v, o, n) \
+	({ s64 __o = (v)->counter; if (__o == (o)) (v)->counter = (n); __o; })
+
+/* virtual time, HZ is 1000 */
+#define NSEC_PER_USEC 1000L
+#define NSEC_PER_MSEC 1000000L
+#define jiffies ((unsigned long)(sim_now_ns / NSEC_PER_MSEC))
+#define msecs_to_jiffies(ms) ((unsigned long)(ms))
+#define jiffies_to_msecs(j) ((unsigned int)(j))
+#define time_after(a, b) ((long)((b) - (a)) < 0)
+#define time_before(a, b) time_after(b, a)
+#define ktime_get_ns() (sim_now_ns)
+#define ktime_get() ((ktime_t)sim_now_ns)
+#define ktime_to_ns(t) ((s64)(t))
+#define ns_to_ktime(ns) ((ktime_t)(ns))
+#define ktime_to_ms(t) ((s64)(t) / NSEC_PER_MSEC)
+
+/* locks only catch recursion, there is a single thread */
+struct mutex { int locked; };
+typedef struct mutex spinlock_t;
+#define DEFINE_MUTEX(n) struct mutex n = { 0 }
+#define mutex_init(m) ((m)->locked = 0)
+#define mutex_destroy(m) do { } while (0)
+#define mutex_trylock(m) ((m)->locked ? 0 : ((m)->locked = 1))
+#define mutex_lock(m) do { BUG_ON((m)->locked); (m)->locked = 1; } while (0)
+#define mutex_unlock(m) do { BUG_ON(!(m)->locked); (m)->locked = 0; } while (0)
+#define lockdep_is_held(m) ((m)->locked)
+#define lockdep_assert_held(m) BUG_ON(!(m)->locked)
+#define spin_lock_init(l) mutex_init(l)
+#define spin_lock(l) mutex_lock(l)
+#define spin_unlock(l) mutex_unlock(l)
+
+typedef struct { unsigned int seq; } seqcount_latch_t;
+#define seqcount_latch_init(l) ((l)->seq = 0)
+#define raw_write_seqcount_latch(l) ((l)->seq++)
+#define raw_read_seqcount_latch(l) ((l)->seq)
+#define read_seqcount_latch_retry(l, s) ((l)->seq != (s))
+
+/* lists */
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(n) { &(n), &(n) }
+#define LIST_HEAD(n) struct list_head n = LIST_HEAD_INIT(n)
+
+static inline void INIT_LIST_HEAD(struct list_head *l)
+{
+	l->next = l->prev = l;
+}
+
+static inline void __list_add(struct list_head *n, struct list_head *prev,
+			struct list_head *next)
+{
+	next->prev = n;
+	n->next = next;
+	n->prev = prev;
+	prev->next = n;
+}
+
+static inline void list_add(struct list_head *n, struct list_head *head)
+{
+	__list_add(n, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *n, struct list_head *head)
+{
+	__list_add(n, head->prev, head);
+}
+
+static inline void list_del(struct list_head *e)
+{
+	e->next->prev = e->prev;
+	e->prev->next = e->next;
+	e->next = e->prev = NULL;
+}
+
+static inline void list_del_init(struct list_head *e)
+{
+	e->next->prev = e->prev;
+	e->prev->next = e->next;
+	INIT_LIST_HEAD(e);
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+static inline void list_move(struct list_head *e, struct list_head *head)
+{
+	list_del(e);
+	list_add(e, head);
+}
+
+static inline void list_replace(struct list_head *old, struct list_head *n)
+{
+	n->next = old->next;
+	n->next->prev = n;
+	n->prev = old->prev;
+	n->prev->next = n;
+}
+
+#define list_entry(p, t, m) container_of(p, t, m)
+#define list_first_entry(p, t, m) list_entry((p)->next, t, m)
+#define list_last_entry(p, t, m) list_entry((p)->prev, t, m)
+#define list_for_each_entry(pos, head, m)				\
+	for (pos = list_entry((head)->next, typeof(*pos), m);		\
+	     &pos->m != (head);						\
+	     pos = list_entry(pos->m.next, typeof(*pos), m))
+#define list_for_each_entry_safe(pos, n, head, m)			\
+	for (pos = list_entry((head)->next, typeof(*pos), m),		\
+	     n = list_entry(pos->m.next, typeof(*pos), m);		\
+	     &pos->m != (head);						\
+	     pos = n, n = list_entry(n->m.next, typeof(*n), m))
+
+/* rcu and kref, there are no concurrent readers */
+struct rcu_head {
+	void *unused;
+};
+
+struct kref {
+	int refcount;
+};
+
+#define kref_init(k) ((k)->refcount = 1)
+#define kref_get(k) ((k)->refcount++)
+#define kref_get_unless_zero(k) ((k)->refcount ? ++(k)->refcount : 0)
+
+static inline int kref_put(struct kref *k, void (*release)(struct kref *))
+{
+	if (--k->refcount)
+		return 0;
+	release(k);
+	return 1;
+}
+
+#define rcu_read_lock() do { } while (0)
+#define rcu_read_unlock() do { } while (0)
+#define synchronize_rcu() do { } while (0)
+#define rcu_dereference(p) (p)
+#define rcu_dereference_protected(p, c) (p)
+#define rcu_access_pointer(p) (p)
+#define rcu_assign_pointer(p, v) ((p) = (v))
+#define RCU_INIT_POINTER(p, v) ((p) = (v))
+#define call_rcu(h, f) ((f)(h))
+
+/*
+ * Workqueues. A queued delayed work expires at virtual time
+ * expires_ns, sim_advance() runs expired work in expiry order.
+ */
+struct work_struct {
+	void (*func)(struct work_struct *work);
+};
+
+struct delayed_work {
+	struct work_struct work;
+	bool pending;
+	bool listed;
+	u64 expires_ns;
+	u64 queued_seq;
+	struct delayed_work *sim_next;
+};
+
+struct workqueue_struct {
+	int unused;
+};
+
+extern struct workqueue_struct *system_wq;
+
+#define WQ_HIGHPRI 1
+#define WQ_UNBOUND 2
+#define WQ_MEM_RECLAIM 4
+#define WORK_CPU_UNBOUND 64
+
+struct workqueue_struct *alloc_workqueue(const char *fmt, unsigned int flags,
+					int max_active, ...);
+void destroy_workqueue(struct workqueue_struct *wq);
+bool mod_delayed_work_on(int cpu, struct workqueue_struct *wq,
+			struct delayed_work *dwork, unsigned long delay);
+bool queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
+			struct delayed_work *dwork, unsigned long delay);
+bool cancel_delayed_work(struct delayed_work *dwork);
+
+#define INIT_DELAYED_WORK(w, f)						\
+	do {								\
+		(w)->work.func = (f);					\
+		(w)->pending = false;					\
+	} while (0)
+#define DECLARE_DELAYED_WORK(n, f) struct delayed_work n = { .work = { f } }
+#define to_delayed_work(w) container_of(w, struct delayed_work, work)
+#define delayed_work_pending(w) ((w)->pending)
+#define cancel_delayed_work_sync(w) cancel_delayed_work(w)
+#define mod_delayed_work(wq, w, d) mod_delayed_work_on(WORK_CPU_UNBOUND, wq, w, d)
+#define queue_delayed_work(wq, w, d) \
+	queue_delayed_work_on(WORK_CPU_UNBOUND, wq, w, d)
+#define schedule_delayed_work(w, d) queue_delayed_work(system_wq, w, d)
+
+/* a single cpu on a single node */
+struct cpumask {
+	unsigned long bits;
+};
+
+extern const struct cpumask *const cpu_online_mask;
+#define nr_cpu_ids 1U
+#define nr_node_ids 1U
+#define cpu_online(c) ((c) == 0)
+#define cpumask_of_node(n) (cpu_online_mask)
+#define cpumask_any_and(a, b) (((a)->bits & (b)->bits) ? 0U : nr_cpu_ids)
+#define irq_get_effective_affinity_mask(irq) (cpu_online_mask)
+
+/* static calls and keys are plain pointers and flags */
+struct static_key_false {
+	bool enabled;
+};
+
+#define DEFINE_STATIC_KEY_FALSE(n) struct static_key_false n = { false }
+#define static_branch_unlikely(k) ((k)->enabled)
+#define static_branch_likely(k) ((k)->enabled)
+#define static_branch_enable(k) ((k)->enabled = true)
+#define static_branch_disable(k) ((k)->enabled = false)
+#define DEFINE_STATIC_CALL_NULL(name, func) typeof(func) *__sc_##name
+#define static_call(name) (*__sc_##name)
+#define static_call_update(name, f) (__sc_##name = (f))
+
+/* crc */
+static inline u32 crc32_le(u32 crc, const unsigned char *p, size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (crc & 1 ? 0xedb88320 : 0);
+	}
+	return crc;
+}
+
+#define crc32(s, p, l) crc32_le(s, p, l)
+
+/* no debugfs, /dev/hpd, runtime pm or module in userspace */
+struct dentry;
+struct device;
+struct inode {
+	void *i_private;
+};
+struct file {
+	void *private_data;
+};
+struct seq_file {
+	void *private;
+	size_t count;
+};
+struct poll_table_struct;
+typedef struct poll_table_struct poll_table;
+typedef struct { int unused; } wait_queue_head_t;
+
+struct file_operations {
+	void *owner;
+	int (*open)(struct inode *, struct file *);
+	ssize_t (*read)(struct file *, char *, size_t, loff_t *);
+	ssize_t (*write)(struct file *, const char *, size_t, loff_t *);
+	__poll_t (*poll)(struct file *, poll_table *);
+	int (*release)(struct inode *, struct file *);
+	loff_t (*llseek)(struct file *, loff_t, int);
+};
+
+struct miscdevice {
+	int minor;
+	const char *name;
+	const struct file_operations *fops;
+	umode_t mode;
+};
+
+#define THIS_MODULE NULL
+#define MISC_DYNAMIC_MINOR 255
+#define EPOLLIN 1
+#define EPOLLRDNORM 2
+#define DECLARE_WAIT_QUEUE_HEAD(n) wait_queue_head_t n
+#define wake_up_interruptible_all(q) ((void)(q))
+#define poll_wait(f, q, p) ((void)(q))
+#define misc_register(m) ((void)(m), 0)
+#define misc_deregister(m) do { } while (0)
+#define no_seek_end_llseek NULL
+#define noop_llseek NULL
+#define seq_lseek NULL
+#define simple_open NULL
+#define single_open(f, s, d) ((void)(s), 0)
+
+static inline ssize_t seq_read(struct file *file, char *buf, size_t count,
+			loff_t *ppos)
+{
+	return 0;
+}
+
+static inline int single_release(struct inode *inode, struct file *file)
+{
+	return 0;
+}
+
+static inline __attribute__((format(printf, 2, 3)))
+void seq_printf(struct seq_file *s, const char *fmt, ...)
+{
+}
+#define seq_puts(s, str) do { } while (0)
+#define debugfs_create_dir(n, p) ((struct dentry *)NULL)
+#define debugfs_create_file(n, m, p, d, f) ((void)(f), (struct dentry *)NULL)
+#define debugfs_create_u32(n, m, p, v) do { } while (0)
+#define debugfs_create_bool(n, m, p, v) do { } while (0)
+#define debugfs_remove_recursive(d) do { } while (0)
+#define DEFINE_SHOW_ATTRIBUTE(__name)					\
+static int __name ## _open(struct inode *inode, struct file *file)	\
+{									\
+	return single_open(file, __name ## _show, inode->i_private);	\
+}									\
+static const struct file_operations __name ## _fops = {			\
+	.open = __name ## _open,					\
+}
+
+#define pm_runtime_resume_and_get(d) 0
+#define pm_runtime_mark_last_busy(d) do { } while (0)
+#define pm_runtime_put_autosuspend(d) do { } while (0)
+
+#define module_param(n, t, p)
+#define MODULE_PARM_DESC(n, d)
+#define EXPORT_SYMBOL(s)
+#define EXPORT_SYMBOL_GPL(s)
+
+/* tracepoints compile away */
+#define TP_PROTO(...) __VA_ARGS__
+#define TP_ARGS(...) __VA_ARGS__
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print)		\
+	static inline void trace_##name(proto) { }
+
+#endif /* __HPD_SIM_SHIM_H__ */
@@ -0,0 +1,696 @@
+/*
+ * HPD: virtual time simulator and latency benchmark for the state machine
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 3, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Replays recorded hpd edge traces against hpd.c built for userspace with
+ * a mock client, and reports per scenario:
+ *
+ *	enables	edid_ready() calls
+ *	lat	plug to enable latency, from the last rising edge before
+ *		each edid_ready(), mean and max in ms
+ *	disable	disable() calls
+ *	ddc	edid transactions, i.e. edid_read, edid_read_start,
+ *		edid_read_base and edid_recheck calls
+ *	state	state the machine settled in
+ *
+ * A scenario is a text file of one directive per line, # starts a comment:
+ *
+ *	<delay_ms> <level>	hpd edge delay_ms after the previous one, as
+ *				written to hpd/<name>/replay in debugfs
+ *	edid <pattern>		outcome of the following edid transactions,
+ *				o ok, x failure, s async read completing only
+ *				after twice edid_timeout_ms; ok once used up
+ *	sink <n>		sink answering edid reads from now on
+ *	option <name>		base: implement edid_read_base
+ *				async: edid_read_start, done after 20 ms
+ *				report: edges by hpd_report_evt()
+ *				prefetch, learn_drop: set the hpd flag
+ *	timing <field> <value>	hpd_timing field, as named in debugfs
+ *	boot			display enabled by bootloader
+ *	expect <what> <value>	state enabled|disabled, enables, disables,
+ *				ddc <= value or lat <= value, the latency
+ *				of the last enable in ms, checked once settled
+ *
+ * "-t field=value" overrides a timing field for all scenarios, to compare
+ * timing policies on the same traces. Exits non zero if an expectation
+ * failed.
+ */
+
+#include "../hpd.h"
+
+#define SIM_MAX_STEPS 256
+#define SIM_ASYNC_MS 20
+#define SIM_SETTLE_MS 60000
+
+int sim_verbose;
+u64 sim_now_ns;
+
+static struct workqueue_struct sim_wq;
+struct workqueue_struct *system_wq = &sim_wq;
+static const struct cpumask sim_cpus = { 1 };
+const struct cpumask *const cpu_online_mask = &sim_cpus;
+
+static struct delayed_work *sim_works;
+static u64 sim_queued_seq;
+static int sim_bugs;
+
+void sim_bug(const char *file, int line)
+{
+	fprintf(stderr, "BUG at %s:%d\n", file, line);
+	abort();
+}
+
+void sim_warn(int line)
+{
+	fprintf(stderr, "WARNING at hpd.c:%d\n", line);
+	sim_bugs++;
+}
+
+struct workqueue_struct *alloc_workqueue(const char *fmt, unsigned int flags,
+					int max_active, ...)
+{
+	return calloc(1, sizeof(struct workqueue_struct));
+}
+
+void destroy_workqueue(struct workqueue_struct *wq)
+{
+	free(wq);
+}
+
+static void sim_work_arm(struct delayed_work *dwork, unsigned long delay)
+{
+	if (!dwork->listed) {
+		dwork->sim_next = sim_works;
+		sim_works = dwork;
+		dwork->listed = true;
+	}
+	dwork->pending = true;
+	dwork->expires_ns = sim_now_ns + delay * NSEC_PER_MSEC;
+	dwork->queued_seq = ++sim_queued_seq;
+}
+
+bool mod_delayed_work_on(int cpu, struct workqueue_struct *wq,
+			struct delayed_work *dwork, unsigned long delay)
+{
+	bool pending = dwork->pending;
+
+	sim_work_arm(dwork, delay);
+
+	return pending;
+}
+
+bool queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
+			struct delayed_work *dwork, unsigned long delay)
+{
+	if (dwork->pending)
+		return false;
+
+	sim_work_arm(dwork, delay);
+
+	return true;
+}
+
+bool cancel_delayed_work(struct delayed_work *dwork)
+{
+	bool pending = dwork->pending;
+
+	dwork->pending = false;
+
+	return pending;
+}
+
+/* Forget work owned by a finished scenario */
+static void sim_work_forget(struct delayed_work *dwork)
+{
+	struct delayed_work **p;
+
+	for (p = &sim_works; *p; p = &(*p)->sim_next)
+		if (*p == dwork) {
+			*p = dwork->sim_next;
+			dwork->listed = false;
+			return;
+		}
+}
+
+/* Earliest work due by @until_ns, NULL if none */
+static struct delayed_work *sim_next_work(u64 until_ns)
+{
+	struct delayed_work *w, *next = NULL;
+
+	for (w = sim_works; w; w = w->sim_next) {
+		if (!w->pending || w->expires_ns > until_ns)
+			continue;
+		if (!next || w->expires_ns < next->expires_ns ||
+			(w->expires_ns == next->expires_ns &&
+			w->queued_seq < next->queued_seq))
+			next = w;
+	}
+
+	return next;
+}
+
+/* Run all work due by @until_ns in expiry order, then move time there */
+static void sim_advance(u64 until_ns)
+{
+	struct delayed_work *w;
+
+	while ((w = sim_next_work(until_ns))) {
+		if (w->expires_ns > sim_now_ns)
+			sim_now_ns = w->expires_ns;
+		w->pending = false;
+		w->work.func(&w->work);
+	}
+	if (until_ns > sim_now_ns)
+		sim_now_ns = until_ns;
+}
+
+/* Run until nothing is pending anymore or @limit_ns is reached */
+static void sim_settle(u64 limit_ns)
+{
+	struct delayed_work *w;
+
+	while ((w = sim_next_work(limit_ns)))
+		sim_advance(w->expires_ns);
+}
+
+struct sim_step {
+	u32 delay_ms;
+	bool level;
+	int sink;		/* sink switched to at this edge, -1 if none */
+};
+
+enum {
+	SIM_EXPECT_STATE,
+	SIM_EXPECT_ENABLES,
+	SIM_EXPECT_DISABLES,
+	SIM_EXPECT_DDC,
+	SIM_EXPECT_LAT,
+	SIM_EXPECT_COUNT,
+};
+
+static const char *const sim_expect_names[SIM_EXPECT_COUNT] = {
+	"state", "enables", "disables", "ddc", "lat",
+};
+
+/* Expectations met by anything up to the value */
+static bool sim_expect_max(int i)
+{
+	return i == SIM_EXPECT_DDC || i == SIM_EXPECT_LAT;
+}
+
+struct sim {
+	const char *name;
+	struct hpd_data hpd;
+	struct hpd_ops ops;
+
+	struct sim_step step[SIM_MAX_STEPS];
+	int steps;
+	bool report;
+	bool boot;
+
+	char edid[SIM_MAX_STEPS];
+	int edid_pos;
+	int sink;
+	int next_sink;		/* sink for the next edge, -1 if unchanged */
+	int read_sink;		/* sink of the edid last read */
+
+	struct delayed_work async_work;
+	bool async_ok;
+
+	bool level;
+	u64 rise_ns;
+
+	int enables;
+	int disables;
+	int ddc;
+	u64 lat_total_ns;
+	u64 lat_max_ns;
+	u64 lat_last_ns;
+
+	bool expect_set[SIM_EXPECT_COUNT];
+	int expect[SIM_EXPECT_COUNT];
+};
+
+struct sim_timing {
+	const char *name;
+	size_t offset;
+};
+
+#define SIM_TIMING(f) { #f, offsetof(struct hpd_timing, f) }
+#define SIM_RETRY(f, n) \
+	{ n, offsetof(struct hpd_timing, edid_retry) + \
+		offsetof(struct hpd_retry_policy, f) }
+
+static const struct sim_timing sim_timings[] = {
+	SIM_TIMING(stabilize_ms),
+	SIM_TIMING(drop_timeout_ms),
+	SIM_TIMING(check_plug_delay_ms),
+	SIM_TIMING(edid_timeout_ms),
+	SIM_TIMING(min_pulse_us),
+	SIM_TIMING(stage_timeout_ms),
+	SIM_TIMING(drop_margin_ms),
+	SIM_RETRY(initial_delay_ms, "edid_initial_delay_ms"),
+	SIM_RETRY(multiplier_pct, "edid_multiplier_pct"),
+	SIM_RETRY(max_delay_ms, "edid_max_delay_ms"),
+	SIM_RETRY(max_attempts, "edid_max_attempts"),
+};
+
+static struct hpd_timing sim_timing_override;
+
+static u32 *sim_timing_field(struct hpd_timing *timing, const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(sim_timings); i++)
+		if (!strcmp(sim_timings[i].name, name))
+			return (u32 *)((char *)timing + sim_timings[i].offset);
+
+	return NULL;
+}
+
+/* Next edid transaction outcome, 'o' once the pattern is used up */
+static char sim_edid_next(struct sim *sim)
+{
+	sim->ddc++;
+	if (!sim->edid[sim->edid_pos])
+		return 'o';
+
+	return sim->edid[sim->edid_pos++];
+}
+
+static void sim_edid_fill(struct sim *sim, u8 *blob)
+{
+	static const u8 header[] = { 0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0 };
+
+	memset(blob, 0, HPD_EDID_BLOCK_LEN);
+	memcpy(blob, header, sizeof(header));
+	/* manufacturer and product code, see struct hpd_quirk */
+	blob[8] = 0x10;
+	blob[9] = 0xac;
+	blob[10] = sim->sink;
+	blob[11] = sim->sink >> 8;
+}
+
+static bool sim_edid_store(struct sim *sim)
+{
+	u8 blob[HPD_EDID_BLOCK_LEN];
+
+	sim_edid_fill(sim, blob);
+	sim->read_sink = sim->sink;
+
+	return !hpd_edid_store(&sim->hpd, blob, sizeof(blob));
+}
+
+static bool sim_get_hpd_state(void *drv_data)
+{
+	struct sim *sim = drv_data;
+
+	return sim->level;
+}
+
+static void sim_disable(void *drv_data)
+{
+	struct sim *sim = drv_data;
+
+	sim->disables++;
+}
+
+static bool sim_edid_read(void *drv_data)
+{
+	struct sim *sim = drv_data;
+
+	if (sim_edid_next(sim) == 'x')
+		return false;
+
+	return sim_edid_store(sim);
+}
+
+static void sim_async_done(struct work_struct *work)
+{
+	struct sim *sim = container_of(to_delayed_work(work), struct sim,
+				async_work);
+
+	if (sim->async_ok)
+		sim->async_ok = sim_edid_store(sim);
+	hpd_edid_read_done(&sim->hpd, sim->async_ok);
+}
+
+static bool sim_edid_read_start(void *drv_data)
+{
+	struct sim *sim = drv_data;
+	u32 delay = SIM_ASYNC_MS;
+
+	switch (sim_edid_next(sim)) {
+	case 'x':
+		sim->async_ok = false;
+		break;
+	case 's':
+		delay = 2 * sim->hpd.timing.edid_timeout_ms;
+		fallthrough;
+	default:
+		sim->async_ok = true;
+		break;
+	}
+	queue_delayed_work(system_wq, &sim->async_work, delay);
+
+	return true;
+}
+
+static bool sim_edid_read_base(void *drv_data, u8 *buf)
+{
+	struct sim *sim = drv_data;
+
+	if (sim_edid_next(sim) == 'x')
+		return false;
+
+	sim_edid_fill(sim, buf);
+
+	return true;
+}
+
+static void sim_edid_ready(void *drv_data)
+{
+	struct sim *sim = drv_data;
+	u64 lat = sim_now_ns - sim->rise_ns;
+
+	sim->enables++;
+	sim->lat_total_ns += lat;
+	sim->lat_max_ns = max(sim->lat_max_ns, lat);
+	sim->lat_last_ns = lat;
+}
+
+static int sim_edid_recheck(void *drv_data)
+{
+	struct sim *sim = drv_data;
+
+	if (sim_edid_next(sim) == 'x')
+		return -1;
+
+	return sim->sink != sim->read_sink;
+}
+
+static int sim_parse_line(struct sim *sim, char *line)
+{
+	char word[32], arg[SIM_MAX_STEPS];
+	u32 delay_ms, value, *field;
+	int level, i;
+
+	line[strcspn(line, "#\n")] = 0;
+	if (sscanf(line, " %31s", word) != 1)
+		return 0;
+
+	if (sscanf(line, "%u %d", &delay_ms, &level) == 2) {
+		if (sim->steps == SIM_MAX_STEPS)
+			return -1;
+		sim->step[sim->steps].delay_ms = delay_ms;
+		sim->step[sim->steps].level = !!level;
+		sim->step[sim->steps].sink = sim->next_sink;
+		sim->next_sink = -1;
+		sim->steps++;
+		return 0;
+	}
+
+	if (!strcmp(word, "edid") && sscanf(line, " %*s %255s", arg) == 1) {
+		strcpy(sim->edid, arg);
+		return 0;
+	}
+
+	if (!strcmp(word, "sink") && sscanf(line, " %*s %u", &value) == 1) {
+		/* Applies from the next edge on */
+		if (sim->steps)
+			sim->next_sink = value;
+		else
+			sim->sink = value;
+		return 0;
+	}
+
+	if (!strcmp(word, "option") && sscanf(line, " %*s %31s", arg) == 1) {
+		if (!strcmp(arg, "base"))
+			sim->ops.edid_read_base = sim_edid_read_base;
+		else if (!strcmp(arg, "async"))
+			sim->ops.edid_read_start = sim_edid_read_start;
+		else if (!strcmp(arg, "report"))
+			sim->report = true;
+		else if (!strcmp(arg, "prefetch"))
+			sim->hpd.flags |= HPD_FLAG_EDID_PREFETCH;
+		else if (!strcmp(arg, "learn_drop"))
+			sim->hpd.flags |= HPD_FLAG_LEARN_DROP;
+		else
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(word, "timing") &&
+		sscanf(line, " %*s %31s %u", arg, &value) == 2) {
+		field = sim_timing_field(&sim->hpd.timing, arg);
+		if (!field)
+			return -1;
+		*field = value;
+		return 0;
+	}
+
+	if (!strcmp(word, "boot")) {
+		sim->boot = true;
+		return 0;
+	}
+
+	if (!strcmp(word, "expect") &&
+		sscanf(line, " %*s %31s %31s", word, arg) == 2) {
+		for (i = 0; i < SIM_EXPECT_COUNT; i++)
+			if (!strcmp(word, sim_expect_names[i]))
+				break;
+		if (i == SIM_EXPECT_COUNT)
+			return -1;
+		if (i == SIM_EXPECT_STATE)
+			value = !strcmp(arg, "enabled") ? STATE_DONE_ENABLED :
+				!strcmp(arg, "disabled") ? STATE_DONE_DISABLED :
+				-1;
+		else if (kstrtou32(arg, 10, &value))
+			return -1;
+		sim->expect_set[i] = true;
+		sim->expect[i] = value;
+		return 0;
+	}
+
+	return -1;
+}
+
+static int sim_load(struct sim *sim, const char *path)
+{
+	char line[512];
+	int lineno = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		if (sim_parse_line(sim, line)) {
+			fprintf(stderr, "%s:%d: bad line\n", path, lineno);
+			fclose(f);
+			return -1;
+		}
+	}
+	fclose(f);
+
+	return 0;
+}
+
+/* Mock client, implementing the ops the scenario asks for */
+static void sim_init_ops(struct sim *sim)
+{
+	sim->ops.get_hpd_state = sim_get_hpd_state;
+	sim->ops.disable = sim_disable;
+	sim->ops.edid_ready = sim_edid_ready;
+	if (!sim->ops.edid_read_start)
+		sim->ops.edid_read = sim_edid_read;
+	if (!sim->ops.edid_read_base)
+		sim->ops.edid_recheck = sim_edid_recheck;
+}
+
+static void sim_edge(struct sim *sim, const struct sim_step *step)
+{
+	if (step->sink >= 0)
+		sim->sink = step->sink;
+	if (step->level && !sim->level)
+		sim->rise_ns = sim_now_ns;
+	sim->level = step->level;
+
+	if (sim->report)
+		hpd_report_evt(&sim->hpd, sim->level, ktime_get());
+	else
+		hpd_set_pending_evt(&sim->hpd);
+}
+
+static bool sim_check(struct sim *sim)
+{
+	int got[SIM_EXPECT_COUNT] = {
+		[SIM_EXPECT_STATE] = sim->hpd.state,
+		[SIM_EXPECT_ENABLES] = sim->enables,
+		[SIM_EXPECT_DISABLES] = sim->disables,
+		[SIM_EXPECT_DDC] = sim->ddc,
+		[SIM_EXPECT_LAT] = sim->lat_last_ns / NSEC_PER_MSEC,
+	};
+	bool ok = true;
+	int i;
+
+	for (i = 0; i < SIM_EXPECT_COUNT; i++) {
+		if (!sim->expect_set[i])
+			continue;
+		if (sim_expect_max(i) ? got[i] <= sim->expect[i] :
+			got[i] == sim->expect[i])
+			continue;
+		printf("%s: FAIL: %s %d, expected %s%d\n", sim->name,
+			sim_expect_names[i], got[i],
+			sim_expect_max(i) ? "<= " : "", sim->expect[i]);
+		ok = false;
+	}
+
+	return ok;
+}
+
+static const char *sim_state_name(int state)
+{
+	switch (state) {
+	case STATE_DONE_ENABLED:
+		return "enabled";
+	case STATE_DONE_DISABLED:
+		return "disabled";
+	default:
+		return "busy";
+	}
+}
+
+static bool sim_run(struct sim *sim)
+{
+	struct hpd_timing *timing = &sim->hpd.timing;
+	u8 boot_edid[HPD_EDID_BLOCK_LEN];
+	bool ok;
+	size_t i;
+	int n;
+
+	sim_now_ns = 0;
+	sim->read_sink = -1;
+	INIT_DELAYED_WORK(&sim->async_work, sim_async_done);
+	sim_init_ops(sim);
+
+	for (i = 0; i < ARRAY_SIZE(sim_timings); i++) {
+		u32 *over = sim_timing_field(&sim_timing_override,
+					sim_timings[i].name);
+
+		if (*over)
+			*sim_timing_field(timing, sim_timings[i].name) = *over;
+	}
+
+	if (sim->boot) {
+		/* Sink is up and its edid known since before the kernel */
+		sim->level = true;
+		sim_edid_fill(sim, boot_edid);
+		sim->read_sink = sim->sink;
+		sim->hpd.boot.enabled = true;
+		sim->hpd.boot.edid = boot_edid;
+		sim->hpd.boot.edid_len = sizeof(boot_edid);
+	}
+
+	hpd_init(&sim->hpd, sim, &sim->ops);
+
+	for (n = 0; n < sim->steps; n++) {
+		sim_advance(sim_now_ns + sim->step[n].delay_ms * NSEC_PER_MSEC);
+		sim_edge(sim, &sim->step[n]);
+	}
+	sim_settle(sim_now_ns + SIM_SETTLE_MS * NSEC_PER_MSEC);
+
+	ok = sim_check(sim);
+	printf("%-28s %7d %7llu %7llu %7d %5d  %s\n", sim->name, sim->enables,
+		sim->enables ? (unsigned long long)(sim->lat_total_ns /
+			sim->enables / NSEC_PER_MSEC) : 0ULL,
+		(unsigned long long)(sim->lat_max_ns / NSEC_PER_MSEC),
+		sim->disables, sim->ddc, sim_state_name(sim->hpd.state));
+
+	hpd_shutdown(&sim->hpd);
+	cancel_delayed_work(&sim->async_work);
+	sim_work_forget(&sim->async_work);
+	sim_work_forget(&sim->hpd.dwork);
+
+	return ok;
+}
+
+static const char *sim_basename(const char *path)
+{
+	const char *p = strrchr(path, '/');
+
+	return p ? p + 1 : path;
+}
+
+static int sim_usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-v] [-t field=value]... scenario...\n",
+		prog);
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	bool ok = true;
+	char *eq;
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-v")) {
+			sim_verbose = 1;
+		} else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+			u32 *field;
+
+			eq = strchr(argv[++i], '=');
+			if (!eq)
+				return sim_usage(argv[0]);
+			*eq = 0;
+			field = sim_timing_field(&sim_timing_override, argv[i]);
+			if (!field || kstrtou32(eq + 1, 10, field)) {
+				fprintf(stderr, "unknown timing %s\n", argv[i]);
+				return 2;
+			}
+		} else {
+			return sim_usage(argv[0]);
+		}
+	}
+	if (i == argc)
+		return sim_usage(argv[0]);
+
+	printf("%-28s %7s %7s %7s %7s %5s  %s\n", "scenario", "enables",
+		"lat", "lat_max", "disable", "ddc", "state");
+
+	for (; i < argc; i++) {
+		struct sim *sim = calloc(1, sizeof(*sim));
+
+		if (!sim)
+			return 1;
+		sim->name = sim_basename(argv[i]);
+		sim->next_sink = -1;
+		if (sim_load(sim, argv[i])) {
+			ok = false;
+		} else if (!sim_run(sim)) {
+			ok = false;
+		}
+		free(sim);
+	}
+
+	if (sim_bugs)
+		ok = false;
+
+	return ok ? 0 : 1;
+}